@@ -0,0 +1,419 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "ctrl.h"
+#include "light.h"
+#include "value.h"
+#include "file.h"
+#include "exec.h"
+#include "als.h"
+
+#define ALS_POLL_MIN_MSEC 250
+#define ALS_POLL_MAX_MSEC 8000
+#define ALS_LUX_MAX 10000.0
+#define ALS_PCT_MIN (VALUE_PCT_MAX / 20)
+#define ALS_SMOOTHING 4
+#define ALS_STABLE 0.02
+#define ALS_HYSTERESIS (VALUE_PCT_MAX / 20)
+#define ALS_FADE_USEC 500000
+#define ALS_REPORT_SEC 60
+
+/**
+ * als:
+ *
+ * An opened ambient light sensor. Either fd is a sysfs attribute
+ * that is re-read when polling, or it is the character device of
+ * a triggered buffer with the illuminance channel as only element.
+ **/
+struct als {
+	int fd;
+	bool buffered;
+	double scale;
+	double offset;
+	char *dir;
+	/* layout of a buffered sample, from in_illuminance_type */
+	char endian;
+	char sign;
+	unsigned int bits;
+	unsigned int storage;
+	unsigned int shift;
+};
+
+static volatile sig_atomic_t als_stop = 0;
+
+static void als_signal(int sig)
+{
+	(void) sig;
+	als_stop = 1;
+}
+
+/**
+ * als_attr_write:
+ * @dir:	device directory
+ * @attr:	attribute below dir
+ * @val:	string to write
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool als_attr_write(const char *dir, const char *attr, const char *val)
+{
+	burn_path p = path_new();
+	burn_fd fd = -1;
+
+	if (!p || !(p = path_append(p, "%s/%s", dir, attr)))
+		return false;
+
+	if ((fd = open(p, O_WRONLY)) < 0)
+		return false;
+
+	return write(fd, val, strlen(val)) == (ssize_t) strlen(val);
+}
+
+/**
+ * als_attr_double:
+ * @dir:	device directory
+ * @attr:	attribute below dir
+ * @def:	value to use if the attribute can not be read
+ *
+ * Returns: the value of the attribute, or def
+ **/
+static double als_attr_double(const char *dir, const char *attr, double def)
+{
+	char buf[64];
+	double val;
+
+	if (!file_read_attr(dir, attr, buf, sizeof(buf)) || sscanf(buf, "%lf", &val) != 1)
+		return def;
+
+	return val;
+}
+
+/**
+ * als_buffer_open:
+ * @als:	sensor to set up
+ * @name:	name of the iio device
+ *
+ * Sets up the triggered buffer of the device with the illuminance
+ * channel as its only element, so that readings arrive on the
+ * character device instead of being polled for.
+ *
+ * Returns: true if the buffer is in use, false to fall back to polling
+ **/
+static bool als_buffer_open(struct als *als, const char *name)
+{
+	char buf[64];
+	burn_path dev = path_new();
+	burn_path scan = path_new();
+	burn_dir dir = NULL;
+
+	/* without a trigger the buffer may never fill up */
+	if (!file_read_attr(als->dir, "trigger/current_trigger", buf, sizeof(buf)) ||
+	    buf[0] == '\0')
+		return false;
+
+	if (!file_read_attr(als->dir, "scan_elements/in_illuminance_type", buf, sizeof(buf)) ||
+	    sscanf(buf, "%ce:%c%u/%u>>%u", &als->endian, &als->sign,
+		   &als->bits, &als->storage, &als->shift) != 5)
+		return false;
+
+	if ((als->storage != 8 && als->storage != 16 &&
+	     als->storage != 32 && als->storage != 64) ||
+	    als->bits == 0 || als->bits > als->storage)
+		return false;
+
+	if (!dev || !(dev = path_append(dev, "%s/%s", path_dev(), name)) ||
+	    !scan || !(scan = path_append(scan, "%s/scan_elements", als->dir)) ||
+	    !(dir = opendir(scan)))
+		return false;
+
+	if (!als_attr_write(als->dir, "buffer/enable", "0"))
+		return false;
+
+	/* make illuminance the only element of a sample */
+	for (char *c; (c = ctrl_iter_next(dir)); path_free(c)) {
+		size_t len = strlen(c);
+		if (len > 3 && strcmp(c + len - 3, "_en") == 0)
+			als_attr_write(scan, c, "0");
+	}
+
+	if (!als_attr_write(als->dir, "scan_elements/in_illuminance_en", "1") ||
+	    !als_attr_write(als->dir, "buffer/enable", "1"))
+		return false;
+
+	if ((als->fd = open(dev, O_RDONLY | O_NONBLOCK)) < 0) {
+		vlog_warning("open '%s': %m", dev);
+		als_attr_write(als->dir, "buffer/enable", "0");
+		return false;
+	}
+
+	vlog_notice("reading ambient light from buffer '%s'", dev);
+	return (als->buffered = true);
+}
+
+/**
+ * als_open:
+ * @als:	sensor to open
+ *
+ * Finds the first iio device with an illuminance channel and opens
+ * it, preferring the triggered buffer over the sysfs attribute.
+ *
+ * Returns: true on success, false if no sensor was found
+ **/
+static bool als_open(struct als *als)
+{
+	burn_path devices = path_new();
+	burn_dir dir = NULL;
+	char *name;
+
+	if (!devices || !(devices = path_append(devices, "%s/bus/iio/devices", path_sysfs())))
+		return false;
+
+	if (!(dir = opendir(devices))) {
+		vlog_err("opendir '%s': %m", devices);
+		return false;
+	}
+
+	while ((name = ctrl_iter_next(dir))) {
+		const char *attr = "in_illuminance_input";
+		burn_path p = path_new();
+
+		if (!p || !(als->dir = path_new()) ||
+		    !(als->dir = path_append(als->dir, "%s/%s", devices, name)) ||
+		    !(p = path_append(p, "%s/%s", als->dir, attr))) {
+			path_free(name);
+			return false;
+		}
+
+		if (access(p, R_OK) != 0) {
+			attr = "in_illuminance_raw";
+			*p = '\0';
+			if (!(p = path_append(p, "%s/%s", als->dir, attr))) {
+				path_free(name);
+				return false;
+			}
+		}
+
+		if (access(p, R_OK) == 0) {
+			als->scale = 1;
+			als->offset = 0;
+			if (strcmp(attr, "in_illuminance_raw") == 0) {
+				als->scale = als_attr_double(als->dir, "in_illuminance_scale", 1);
+				als->offset = als_attr_double(als->dir, "in_illuminance_offset", 0);
+			}
+
+			if (als_buffer_open(als, name) || (als->fd = open(p, O_RDONLY)) >= 0) {
+				vlog_notice("using ambient light sensor '%s'", name);
+				path_free(name);
+				return true;
+			}
+
+			vlog_warning("open '%s': %m", p);
+		}
+
+		path_free(als->dir);
+		als->dir = NULL;
+		path_free(name);
+	}
+
+	vlog_err("could not find an ambient light sensor");
+	return false;
+}
+
+/**
+ * als_close:
+ * @als:	sensor to close
+ **/
+static void als_close(struct als *als)
+{
+	if (als->buffered)
+		als_attr_write(als->dir, "buffer/enable", "0");
+	if (als->fd >= 0)
+		close(als->fd);
+	path_free(als->dir);
+}
+
+/**
+ * als_sample:
+ * @als:	sensor the sample belongs to
+ * @buf:	raw sample bytes
+ *
+ * Decodes a buffered sample according to its scan type.
+ *
+ * Returns: the decoded raw reading
+ **/
+static double als_sample(const struct als *als, const unsigned char *buf)
+{
+	uint64_t word = 0;
+	unsigned int bytes = als->storage / 8;
+
+	for (unsigned int i = 0; i < bytes; i++) {
+		unsigned int b = als->endian == 'b' ? i : bytes - 1 - i;
+		word = (word << 8) | buf[b];
+	}
+
+	word >>= als->shift;
+	if (als->bits < 64)
+		word &= (UINT64_C(1) << als->bits) - 1;
+
+	if (als->sign == 's' && als->bits < 64 && (word >> (als->bits - 1)) & 1)
+		return (double) ((int64_t) word - (INT64_C(1) << als->bits));
+
+	return (double) word;
+}
+
+/**
+ * als_read:
+ * @als:	sensor to read
+ * @lux:	where to store the reading
+ *
+ * Reads the latest illuminance, draining any queued buffer samples.
+ *
+ * Returns: true if a reading was stored, otherwise false
+ **/
+static bool als_read(const struct als *als, double *lux)
+{
+	unsigned char buf[64];
+	double raw;
+	ssize_t r;
+	bool got = false;
+
+	if (als->buffered) {
+		while ((r = read(als->fd, buf, als->storage / 8)) == (ssize_t) (als->storage / 8)) {
+			raw = als_sample(als, buf);
+			got = true;
+		}
+		if (!got)
+			return false;
+	} else {
+		if ((r = pread(als->fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+			vlog_err("reading ambient light: %m");
+			return false;
+		}
+		buf[r] = '\0';
+		if (sscanf((char *) buf, "%lf", &raw) != 1)
+			return false;
+	}
+
+	*lux = (raw + als->offset) * als->scale;
+	return true;
+}
+
+/**
+ * als_to_pct:
+ * @lux:	smoothed illuminance
+ *
+ * Maps illuminance on a logarithmic scale, matching how the
+ * eye perceives it, to a brightness percentage.
+ *
+ * Returns: the percentage
+ **/
+static int64_t als_to_pct(double lux)
+{
+	int64_t pct;
+
+	if (lux < 0)
+		lux = 0;
+
+	pct = (int64_t) (log10(1 + lux) / log10(1 + ALS_LUX_MAX) * VALUE_PCT_MAX);
+
+	return pct < ALS_PCT_MIN ? ALS_PCT_MIN : VALUE_CLAMP_PCT(pct);
+}
+
+/**
+ * als_run:
+ * @conf:	configuration object to operate on
+ *
+ * Follows the ambient light sensor until interrupted. Readings are
+ * smoothed, and the brightness is only changed once the target moved
+ * past the hysteresis. When polling, the interval backs off while
+ * the readings are stable. Wakeups are reported every minute.
+ *
+ * Returns: true when stopped by a signal, false on failure
+ **/
+bool als_run(struct light_conf *conf)
+{
+	struct als als = { .fd = -1 };
+	struct sigaction sa = { .sa_handler = als_signal };
+	struct timespec t0, t1;
+	int timeout = ALS_POLL_MIN_MSEC;
+	int64_t wakeups = 0, applied = -1;
+	double lux, prev = -1, smooth = -1;
+	bool ret = true;
+
+	if (!als_open(&als)) {
+		als_close(&als);
+		return false;
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (conf->val_mode == LIGHT_RAW)
+		conf->val_mode = LIGHT_PERCENT;
+	if (conf->usec == 0)
+		conf->usec = ALS_FADE_USEC;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	while (!als_stop) {
+		if (als_read(&als, &lux)) {
+			int64_t pct;
+
+			smooth = smooth < 0 ? lux : smooth + (lux - smooth) / ALS_SMOOTHING;
+
+			/* back off while the light does not change */
+			if (prev >= 0 && fabs(lux - prev) <= ALS_STABLE * (prev + 1))
+				timeout = timeout * 2 > ALS_POLL_MAX_MSEC ? ALS_POLL_MAX_MSEC : timeout * 2;
+			else
+				timeout = ALS_POLL_MIN_MSEC;
+			prev = lux;
+
+			pct = als_to_pct(smooth);
+			vlog_debug("ambient light: %.1f lux (smoothed %.1f)", lux, smooth);
+
+			if (applied < 0 || llabs(pct - applied) >= ALS_HYSTERESIS) {
+				vlog_info("ambient light target: %" PRId64, pct);
+				if (!exec_apply(conf, LIGHT_SET, conf->val_mode, pct, conf->usec)) {
+					ret = false;
+					break;
+				}
+				applied = pct;
+			}
+		}
+
+		vlog_flush();
+
+		/* sysfs attributes always poll readable, so just sleep on them */
+		if (poll(&(struct pollfd) { .fd = als.fd, .events = POLLIN },
+			 als.buffered ? 1 : 0, als.buffered ? -1 : timeout) < 0 &&
+		    errno != EINTR) {
+			vlog_err("poll: %m");
+			ret = false;
+			break;
+		}
+		wakeups++;
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (t1.tv_sec - t0.tv_sec >= ALS_REPORT_SEC) {
+			vlog_notice("ambient light: %" PRId64 " wakeups in %ld seconds",
+				    wakeups, (long) (t1.tv_sec - t0.tv_sec));
+			wakeups = 0;
+			t0 = t1;
+		}
+	}
+
+	als_close(&als);
+	return ret;
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef ALS_H
+#define ALS_H
+
+#include <stdbool.h>
+
+#include "light.h"
+
+bool als_run(struct light_conf *conf);
+
+#endif /* ALS_H */
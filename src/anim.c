@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "light.h"
+#include "value.h"
+#include "dither.h"
+#include "anim.h"
+
+#define ANIM_EASE_STEPS 8
+#define ANIM_PATTERN_MAX 4096
+
+static volatile sig_atomic_t anim_stop = 0;
+
+static void anim_signal(int sig)
+{
+	(void) sig;
+	anim_stop = 1;
+}
+
+/**
+ * anim_key_parse:
+ * @conf:	configuration object with the value mode
+ * @s:		"value milliseconds [curve]" line
+ * @k:		keyframe to fill in
+ *
+ * Returns: true on success, false if the line is not recognizable
+ **/
+static bool anim_key_parse(struct light_conf *conf, const char *s, struct anim_key *k)
+{
+	char val[64], curve[16] = "linear";
+	int64_t ms;
+
+	if (sscanf(s, "%63s %" SCNd64 " %15s", val, &ms, curve) < 2 || ms < 0)
+		return false;
+
+	if (strcmp(val, "start") == 0)
+		k->value = -1;
+	else if ((k->value = value_from_string(conf->val_mode, val)) < 0)
+		return false;
+
+	k->usec = ms * 1000;
+	k->curve = FILE_CURVE_LINEAR;
+	k->step = false;
+
+	if (strcmp(curve, "ease") == 0)
+		k->curve = FILE_CURVE_EASE;
+	else if (strcmp(curve, "step") == 0)
+		k->step = true;
+	else if (strcmp(curve, "linear") != 0)
+		return false;
+
+	return true;
+}
+
+/**
+ * anim_load:
+ * @conf:	configuration object holding the keyframe path
+ * @a:		animation to load into
+ *
+ * Loads "value milliseconds [linear|ease|step]" lines, where value is
+ * given in the value mode of conf, or is "start" for the brightness
+ * the animation started at. A "repeat count" line sets how often the
+ * keyframes are played. Empty lines and lines starting with '#' are
+ * skipped.
+ *
+ * Returns: true on success, false on failure
+ **/
+bool anim_load(struct light_conf *conf, struct anim *a)
+{
+	char line[256];
+	int lineno = 0;
+	burn_file file = fopen(conf->file, "r");
+
+	a->n = 0;
+	a->repeat = 1;
+
+	if (!file) {
+		vlog_err("fopen '%s': %m", conf->file);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		char *s = line + strspn(line, " \t");
+
+		lineno++;
+		if (*s == '#' || *s == '\n' || *s == '\0')
+			continue;
+
+		if (strncmp(s, "repeat", 6) == 0) {
+			if (sscanf(s, "repeat %" SCNd64, &a->repeat) == 1 && a->repeat >= 0)
+				continue;
+			vlog_err("%s:%d: expected 'repeat count'", conf->file, lineno);
+			return false;
+		}
+
+		if (a->n == ANIM_KEYS_MAX) {
+			vlog_err("%s: more than %d keyframes", conf->file, ANIM_KEYS_MAX);
+			return false;
+		}
+
+		if (!anim_key_parse(conf, s, &a->key[a->n])) {
+			vlog_err("%s:%d: expected 'value milliseconds [linear|ease|step]'",
+				 conf->file, lineno);
+			return false;
+		}
+
+		a->n++;
+	}
+
+	if (a->n == 0)
+		vlog_err("%s: no keyframes", conf->file);
+
+	return a->n > 0;
+}
+
+/**
+ * anim_raw:
+ * @a:		animation to convert
+ * @mode:	mode the values are given in
+ * @start:	raw brightness the animation starts at
+ * @mincap:	minimum raw value
+ * @maxcap:	highest raw value to go to
+ * @max:	maximum raw value
+ *
+ * Converts the keyframe values to raw values of the controller. The
+ * start is kept as it is, even outside the caps.
+ **/
+void anim_raw(struct anim *a, LIGHT_VAL_MODE mode, int64_t start, int64_t mincap,
+	      int64_t maxcap, int64_t max)
+{
+	for (int i = 0; i < a->n; i++) {
+		struct anim_key *k = &a->key[i];
+
+		if (k->value < 0)
+			k->raw = start;
+		else
+			k->raw = value_clamp(value_to_raw(mode, k->value, max), mincap, maxcap);
+	}
+}
+
+/**
+ * anim_pattern_put:
+ * @buf:	pattern being built, of ANIM_PATTERN_MAX bytes
+ * @len:	length of the pattern so far, updated
+ * @raw:	brightness of the pair
+ * @ms:		duration of the pair
+ *
+ * Returns: true if the pair fits, false otherwise
+ **/
+static bool anim_pattern_put(char *buf, size_t *len, int64_t raw, int64_t ms)
+{
+	int r = snprintf(buf + *len, ANIM_PATTERN_MAX - *len, "%s%" PRId64 " %" PRId64,
+			 *len ? " " : "", raw, ms);
+
+	if (r < 0 || (size_t) r >= ANIM_PATTERN_MAX - *len)
+		return false;
+
+	*len += (size_t) r;
+	return true;
+}
+
+/**
+ * anim_pattern:
+ * @conf:	configuration object
+ * @a:		animation with raw values
+ * @start:	raw brightness the animation starts at
+ *
+ * Compiles the animation to a pattern for the pattern trigger of an
+ * LED, which then plays it in the kernel. The trigger only moves
+ * linearly and loops back to where it started, so ease curves are
+ * made of ANIM_EASE_STEPS linear pieces and the last keyframe has to
+ * end at the start.
+ *
+ * Returns: true if the pattern runs, false to play the animation instead
+ **/
+bool anim_pattern(struct light_conf *conf, const struct anim *a, int64_t start)
+{
+	char pattern[ANIM_PATTERN_MAX];
+	size_t len = 0;
+	int64_t from = start;
+
+	if (conf->target != LIGHT_KEYBOARD || a->key[a->n - 1].raw != start)
+		return false;
+
+	/* each pair moves from its brightness to the one of the next pair */
+	for (int i = 0; i < a->n; i++) {
+		const struct anim_key *k = &a->key[i];
+		int64_t ms = k->usec / 1000;
+		bool fits = true;
+
+		if (k->step) {
+			fits = anim_pattern_put(pattern, &len, from, 0) &&
+			       anim_pattern_put(pattern, &len, k->raw, ms);
+		} else if (k->curve == FILE_CURVE_EASE && from != k->raw) {
+			for (int j = 0; fits && j < ANIM_EASE_STEPS; j++) {
+				double p = (double) j / ANIM_EASE_STEPS;
+				int64_t raw = from + (int64_t) ((double) (k->raw - from) * p * p * (3 - 2 * p));
+
+				fits = anim_pattern_put(pattern, &len, raw, ms * (j + 1) / ANIM_EASE_STEPS -
+							ms * j / ANIM_EASE_STEPS);
+			}
+		} else {
+			fits = anim_pattern_put(pattern, &len, from, ms);
+		}
+
+		if (!fits) {
+			vlog_info("animation too long for a pattern");
+			return false;
+		}
+
+		from = k->raw;
+	}
+
+	return dither_play(conf, pattern, a->repeat > 0 ? a->repeat : -1);
+}
+
+/**
+ * anim_now:
+ * @ctx:	unused
+ *
+ * Returns: CLOCK_MONOTONIC in nanoseconds
+ **/
+static int64_t anim_now(void *ctx)
+{
+	struct timespec t;
+
+	(void) ctx;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/**
+ * anim_sleep:
+ * @ctx:	unused
+ * @until:	CLOCK_MONOTONIC nanoseconds to sleep until
+ *
+ * Returns: true once until passed, false if interrupted by a signal
+ **/
+static bool anim_sleep(void *ctx, int64_t until)
+{
+	struct timespec t = {
+		.tv_sec = (time_t) (until / 1000000000),
+		.tv_nsec = (long) (until % 1000000000),
+	};
+	int r;
+
+	(void) ctx;
+
+	while ((r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)) == EINTR)
+		if (anim_stop)
+			return false;
+
+	if (r != 0) {
+		errno = r;
+		vlog_err("clock_nanosleep: %m");
+		return false;
+	}
+
+	return !anim_stop;
+}
+
+static const struct file_clock anim_monotonic = {
+	.now = anim_now,
+	.sleep = anim_sleep,
+};
+
+/**
+ * anim_clock:
+ *
+ * Stops the animation on SIGINT and SIGTERM from now on.
+ *
+ * Returns: the clock to play the animation on, which stops sleeping
+ *	    once the animation is interrupted
+ **/
+const struct file_clock *anim_clock(void)
+{
+	struct sigaction sa = { .sa_handler = anim_signal };
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	return &anim_monotonic;
+}
+
+/**
+ * anim_stopped:
+ *
+ * Returns: true if the animation was interrupted
+ **/
+bool anim_stopped(void)
+{
+	return anim_stop;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "light.h"
+#include "file.h"
+
+#define ANIM_KEYS_MAX 64
+
+/**
+ * anim_key:
+ *
+ * A keyframe: move to value over usec along curve, or jump to it
+ * and hold it for usec if step is set. A value of -1 stands for
+ * the brightness the animation started at. raw is filled in once
+ * the controller is known.
+ **/
+struct anim_key {
+	int64_t value;
+	int64_t usec;
+	FILE_CURVE curve;
+	bool step;
+	int64_t raw;
+};
+
+/**
+ * anim:
+ *
+ * A keyframe list, played repeat times, or until interrupted if 0.
+ **/
+struct anim {
+	struct anim_key key[ANIM_KEYS_MAX];
+	int n;
+	int64_t repeat;
+};
+
+bool anim_load(struct light_conf *conf, struct anim *a);
+void anim_raw(struct anim *a, LIGHT_VAL_MODE mode, int64_t start, int64_t mincap,
+	      int64_t maxcap, int64_t max);
+bool anim_pattern(struct light_conf *conf, const struct anim *a, int64_t start);
+const struct file_clock *anim_clock(void);
+bool anim_stopped(void);
+
+#endif /* ANIM_H */
@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: 0BSD */
+
+#include <fcntl.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "cfg.h"
+
+#define CFG_ENTRIES_MAX 64
+
+struct cfg_entry {
+	char key[CFG_KEY_MAX];
+	char val[CFG_VAL_MAX];
+};
+
+/**
+ * cfg_reader:
+ *
+ * Line reader over a file descriptor, which unlike stdio does not
+ * allocate. Lines longer than the buffer come in pieces.
+ **/
+struct cfg_reader {
+	int fd;
+	size_t pos;
+	size_t len;
+	char buf[CFG_KEY_MAX + CFG_VAL_MAX];
+};
+
+static struct cfg_entry cfg_entries[CFG_ENTRIES_MAX];
+static int cfg_count = -1;
+
+/**
+ * cfg_path_new:
+ *
+ * Picks the configuration file: BRILLO_CONF unless running setuid,
+ * the system-wide one for root, otherwise the one in the XDG config
+ * directory.
+ *
+ * WARNING: this function allocates memory, but does not free it.
+ *
+ * Returns: the path, or NULL on failure
+ **/
+static char *cfg_path_new(void)
+{
+	char *s;
+	const char *env, *fmt;
+
+	if ((env = getenv("BRILLO_CONF")) && geteuid() == getuid() && getegid() == getgid())
+		fmt = "%s";
+	else if (geteuid() == 0 && (env = SYSCONFDIR))
+		fmt = "%s/" PROG ".conf";
+	else if ((env = getenv("XDG_CONFIG_HOME")))
+		fmt = "%s/" PROG ".conf";
+	else if ((env = getenv("HOME")))
+		fmt = "%s/.config/" PROG ".conf";
+	else
+		return NULL;
+
+	if (!(s = path_new()))
+		return NULL;
+
+	return path_append(s, fmt, env);
+}
+
+/**
+ * cfg_line:
+ * @r:		reader to take the line from
+ *
+ * Returns: the next line, without its newline, or NULL at the end
+ **/
+static char *cfg_line(struct cfg_reader *r)
+{
+	char *line = r->buf + r->pos, *nl;
+	ssize_t n;
+
+	while (!(nl = memchr(line, '\n', r->len - r->pos))) {
+		memmove(r->buf, line, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+		line = r->buf;
+
+		if (r->len == sizeof(r->buf) - 1 ||
+		    (n = read(r->fd, r->buf + r->len, sizeof(r->buf) - 1 - r->len)) <= 0) {
+			if (r->len == 0)
+				return NULL;
+			r->buf[r->len] = '\0';
+			r->pos = r->len;
+			return line;
+		}
+
+		r->len += n;
+	}
+
+	*nl = '\0';
+	r->pos = nl + 1 - r->buf;
+	return line;
+}
+
+/**
+ * cfg_load:
+ *
+ * Reads "key value" lines from the configuration file once.
+ * Empty lines and lines starting with '#' are skipped, and
+ * a missing file is the same as an empty one.
+ **/
+static void cfg_load(void)
+{
+	struct cfg_reader r = { .fd = -1 };
+	burn_path path = NULL;
+	burn_fd fd = -1;
+	char *line;
+
+	if (cfg_count >= 0)
+		return;
+
+	cfg_count = 0;
+
+	if (!(path = cfg_path_new()) || (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+
+	vlog_info("reading configuration from '%s'", path);
+	r.fd = fd;
+
+	while ((line = cfg_line(&r))) {
+		struct cfg_entry *e = &cfg_entries[cfg_count];
+		char *s = line + strspn(line, " \t");
+		size_t len;
+
+		if (*s == '#' || *s == '\n' || *s == '\0')
+			continue;
+
+		if (cfg_count == CFG_ENTRIES_MAX) {
+			vlog_warning("%s: ignoring entries past %d", path, CFG_ENTRIES_MAX);
+			break;
+		}
+
+		if ((len = strcspn(s, " \t\n")) >= CFG_KEY_MAX) {
+			vlog_warning("%s: ignoring overlong key", path);
+			continue;
+		}
+
+		memcpy(e->key, s, len);
+		e->key[len] = '\0';
+
+		s += len;
+		s += strspn(s, " \t");
+		len = strcspn(s, "\n");
+		while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t'))
+			len--;
+
+		if (len >= CFG_VAL_MAX) {
+			vlog_warning("%s: ignoring overlong value for '%s'", path, e->key);
+			continue;
+		}
+
+		memcpy(e->val, s, len);
+		e->val[len] = '\0';
+		cfg_count++;
+	}
+}
+
+/**
+ * cfg_get:
+ * @key:	key to look up
+ *
+ * Returns: the last value given for key, or NULL if it is not set
+ **/
+const char *cfg_get(const char *key)
+{
+	cfg_load();
+
+	for (int i = cfg_count - 1; i >= 0; i--)
+		if (strcmp(cfg_entries[i].key, key) == 0)
+			return cfg_entries[i].val;
+
+	return NULL;
+}
+
+/**
+ * cfg_next:
+ * @prefix:	prefix of the keys to iterate over
+ * @pos:	iterator position, 0 to start
+ * @val:	where to store the value
+ *
+ * Iterates over the keys starting with prefix, in file order.
+ * A key given twice is only visited for its last value.
+ *
+ * Returns: the next key, or NULL at the end
+ **/
+const char *cfg_next(const char *prefix, int *pos, const char **val)
+{
+	cfg_load();
+
+	for (; *pos < cfg_count; (*pos)++) {
+		struct cfg_entry *e = &cfg_entries[*pos];
+
+		if (strncmp(e->key, prefix, strlen(prefix)) == 0 && cfg_get(e->key) == e->val) {
+			*val = e->val;
+			return cfg_entries[(*pos)++].key;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * cfg_int:
+ * @key:	key to look up
+ * @def:	value to use if the key is not set or invalid
+ *
+ * Returns: the integer value of key, or def
+ **/
+int64_t cfg_int(const char *key, int64_t def)
+{
+	const char *val = cfg_get(key);
+	int64_t i;
+
+	if (!val)
+		return def;
+
+	if (sscanf(val, "%" SCNd64, &i) != 1) {
+		vlog_warning("configuration: '%s' is not a number", key);
+		return def;
+	}
+
+	return i;
+}
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: 0BSD */
+
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+
+#define CFG_KEY_MAX 64
+#define CFG_VAL_MAX 192
+
+const char *cfg_get(const char *key);
+int64_t cfg_int(const char *key, int64_t def);
+const char *cfg_next(const char *prefix, int *pos, const char **val);
+
+#endif /* CFG_H */
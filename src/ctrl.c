@@ -1,15 +1,25 @@
 /* SPDX-License-Identifier: GPL-3.0-only */
 
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 
 #include "common.h"
 
 #include "burno.h"
 #include "vlog.h"
+#include "path.h"
+#include "cfg.h"
+#include "init.h"
 #include "light.h"
+#include "file.h"
 #include "exec.h"
+#include "ddc.h"
 #include "ctrl.h"
 
+#define CTRL_BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define CTRL_BOOT_ID_MAX 40
+
 /**
  * ctrl_iter_next:
  * @dir:	opened directory to iterate over
@@ -17,7 +27,7 @@
  * Iterates over the directory given by dir.
  *
  * WARNING: will allocate a string and return it,
- *          this string should be freed after use
+ *          this string should be freed with path_free()
  *
  * Returns: name of the next controller, NULL on end of dir or failure
  **/
@@ -31,35 +41,427 @@ char *ctrl_iter_next(DIR * dir)
 	}
 
 	while ((file = readdir(dir))) {
+		char *p;
+
 		if (file->d_name[0] != '.')
-			return strdup(file->d_name);
+			return (p = path_new()) ? path_append(p, "%s", file->d_name) : NULL;
 	}
 
 	return NULL;
 }
 
 /**
- * ctrl_auto:
+ * ctrl_ddc_save:
+ * @conf:	configuration object holding the controller
+ * @val:	result of the probe
+ *
+ * Stores the result of a DDC/CI probe in the cache.
+ **/
+static void ctrl_ddc_save(struct light_conf *conf, int64_t val)
+{
+	struct file_fade fade = { 0 };
+	burn_path path = init_cache(conf, true) ? light_path_new(conf, LIGHT_DDC) : NULL;
+	burn_fd fd = path ? file_open(path, O_WRONLY) : -1;
+
+	if (fd >= 0)
+		file_write(fd, val, val, &fade);
+}
+
+/**
+ * ctrl_ddc_next:
  * @conf:	configuration object to work on
+ * @dir:	opened device directory to iterate over
+ * @probe:	whether to probe buses that were not probed before
  *
- * Iterates over the appropriate directory and finds the
- * controller with the highest max brightness. Stores the
- * name of the controller and the max brightness value in
- * the configuration object
+ * Iterates over the i2c buses in dir and returns the next one
+ * with a DDC/CI display, as a controller name. Probing takes
+ * seconds, so its result is kept in the cache for each bus,
+ * also when the bus could not be opened.
  *
- * WARNING: will return an allocated string, which
- *          should be freed after use
+ * WARNING: will allocate a string and return it,
+ *          this string should be freed with path_free()
  *
- * Returns: best controller, or NULL if no suitable controller is found
+ * Returns: name of the next controller, NULL on end of dir or failure
  **/
-bool ctrl_auto(struct light_conf *conf)
+char *ctrl_ddc_next(struct light_conf *conf, DIR *dir, bool probe)
+{
+	char *saved = conf->ctrl, *next = NULL;
+	struct dirent *file;
+
+	while (!next && dir && (file = readdir(dir))) {
+		int64_t found;
+
+		if (strncmp(file->d_name, "i2c-", 4) != 0 || !file->d_name[4] ||
+		    file->d_name[4 + strspn(file->d_name + 4, "0123456789")])
+			continue;
+
+		if (!(conf->ctrl = path_new()) ||
+		    !(conf->ctrl = path_append(conf->ctrl, DDC_PREFIX "%s", file->d_name)))
+			break;
+
+		if ((found = light_fetch(conf, LIGHT_DDC)) < 0 && probe) {
+			vlog_info("probing '%s' for DDC/CI", conf->ctrl);
+			if ((found = ddc_probe(conf->ctrl)) < 0)
+				found = 0;
+			ctrl_ddc_save(conf, found);
+		}
+
+		if (found > 0)
+			next = conf->ctrl;
+		else
+			path_free(conf->ctrl);
+	}
+
+	conf->ctrl = saved;
+	return next;
+}
+
+/**
+ * ctrl_ddc_dir:
+ * @conf:	configuration object to work on
+ *
+ * Returns: the opened device directory if DDC/CI displays are
+ *	    controllers of the target, otherwise NULL
+ **/
+DIR *ctrl_ddc_dir(struct light_conf *conf)
+{
+	return conf->target == LIGHT_BACKLIGHT ? opendir(path_dev()) : NULL;
+}
+
+/**
+ * ctrl_attr_path:
+ * @conf:	configuration object holding the sysfs prefix
+ * @name:	controller
+ * @attr:	attribute of the controller
+ *
+ * WARNING: will allocate a string and return it,
+ *          this string should be freed with path_free()
+ *
+ * Returns: the path of the attribute, or NULL on failure
+ **/
+static char *ctrl_attr_path(struct light_conf *conf, const char *name, const char *attr)
+{
+	char *p = path_new();
+
+	return p ? path_append(p, "%s/%s/%s", conf->sys_prefix, name, attr) : NULL;
+}
+
+/**
+ * ctrl_type:
+ * @conf:	configuration object holding the sysfs prefix
+ * @name:	backlight controller
+ *
+ * Ranks the type of a backlight. Of the interfaces to one panel,
+ * the kernel asks for firmware ones to be preferred over platform
+ * ones, and those over raw ones.
+ *
+ * Returns: 3 for firmware, 2 for platform, 1 for raw, 0 if unknown
+ **/
+static int ctrl_type(struct light_conf *conf, const char *name)
+{
+	static const char *types[] = { "raw", "platform", "firmware" };
+	char buf[16];
+	burn_path path = ctrl_attr_path(conf, name, "type");
+
+	if (!path || file_read_str(path, buf, sizeof(buf)) < 0)
+		return 0;
+
+	buf[strcspn(buf, "\n")] = '\0';
+	for (int i = 0; i < 3; i++) {
+		if (strcmp(buf, types[i]) == 0)
+			return i + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * ctrl_below:
+ * @dev:	resolved device of one controller
+ * @parent:	resolved device of another one
+ *
+ * A native backlight hangs below the display connector of a GPU,
+ * a firmware or platform one below the GPU itself or elsewhere.
+ *
+ * Returns: true if dev is parent or one of its descendants
+ **/
+static bool ctrl_below(const char *dev, const char *parent)
+{
+	size_t len = strlen(parent);
+
+	return dev[0] != '\0' && len > 0 && strncmp(dev, parent, len) == 0 &&
+	       (dev[len] == '/' || dev[len] == '\0');
+}
+
+/**
+ * ctrl_groups_scan:
+ * @conf:	configuration object holding the sysfs prefix
+ * @g:		controllers to fill in the maximum and lead of
+ *
+ * Reads the maximum of every controller and, for backlights, the
+ * type and device link. A firmware or platform controller drives
+ * the same output as the one raw controller below its device, if
+ * there is exactly one: above several, as for dual panels on one
+ * GPU, it cannot tell which, and raw controllers never share an
+ * output. The lead of each output is the accessible controller of
+ * the preferred type, then the most precise one, then the first.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool ctrl_groups_scan(struct light_conf *conf, struct ctrl_groups *g)
+{
+	char *saved = conf->ctrl;
+	int type[CTRL_GROUPS_MAX], out[CTRL_GROUPS_MAX];
+	burn_o char (*dev)[PATH_MAX] = calloc((size_t) g->n, PATH_MAX);
+
+	if (!dev) {
+		vlog_err("calloc: %m");
+		return false;
+	}
+
+	for (int i = 0; i < g->n; i++) {
+		struct ctrl_group *c = &g->ctrl[i];
+		burn_path link = NULL;
+
+		conf->ctrl = c->name;
+		if ((c->max = light_fetch(conf, LIGHT_MAX_BRIGHTNESS)) <= 0) {
+			vlog_warning("found inaccessible controller '%s'", c->name);
+			c->max = -1;
+		}
+		type[i] = 0;
+
+		if (conf->target != LIGHT_BACKLIGHT)
+			continue;
+
+		type[i] = ctrl_type(conf, c->name);
+		if (!(link = ctrl_attr_path(conf, c->name, "device")) || !realpath(link, dev[i]))
+			dev[i][0] = '\0';
+	}
+
+	conf->ctrl = saved;
+
+	/* number the outputs by their raw controller */
+	for (int i = 0; i < g->n; i++) {
+		int raw = -1, n = 0;
+
+		out[i] = i;
+		if (type[i] < 2)
+			continue;
+
+		for (int j = 0; j < g->n; j++) {
+			if (type[j] == 1 && ctrl_below(dev[j], dev[i])) {
+				raw = j;
+				n++;
+			}
+		}
+
+		if (n == 1)
+			out[i] = raw;
+		else if (n > 1)
+			vlog_info("'%s' is above %d raw controllers, not grouping it", g->ctrl[i].name, n);
+	}
+
+	for (int i = 0; i < g->n; i++)
+		g->ctrl[i].lead = out[i];
+
+	for (int i = 0; i < g->n; i++) {
+		struct ctrl_group *c = &g->ctrl[i], *lead = &g->ctrl[out[i]];
+		int l = lead->lead;
+
+		if (l != i && (c->max > 0) >= (g->ctrl[l].max > 0) &&
+		    ((c->max > 0) > (g->ctrl[l].max > 0) || type[i] > type[l] ||
+		     (type[i] == type[l] && c->max > g->ctrl[l].max)))
+			lead->lead = i;
+	}
+
+	for (int i = 0; i < g->n; i++)
+		g->ctrl[i].lead = g->ctrl[out[i]].lead;
+
+	return true;
+}
+
+/**
+ * ctrl_groups_path:
+ * @conf:	configuration object
+ * @create:	whether the cache dir has to exist
+ * @suffix:	suffix of the file name
+ *
+ * WARNING: will allocate a string and return it,
+ *          this string should be freed with path_free()
+ *
+ * Returns: the path of the cached groups, or NULL on failure
+ **/
+static char *ctrl_groups_path(struct light_conf *conf, bool create, const char *suffix)
+{
+	const char *prefix = init_cache(conf, create);
+	char *p = prefix ? path_new() : NULL;
+
+	return p ? path_append(p, "%s.groups%s", prefix, suffix) : NULL;
+}
+
+/**
+ * ctrl_boot_id:
+ * @buf:	where to store the id, CTRL_BOOT_ID_MAX bytes
+ *
+ * Identifies the running boot, as drivers may report another
+ * maximum after a kernel update.
+ *
+ * Returns: buf, empty if the id is unknown
+ **/
+static char *ctrl_boot_id(char *buf)
+{
+	if (file_read_str(CTRL_BOOT_ID, buf, CTRL_BOOT_ID_MAX) < 0)
+		buf[0] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return buf;
+}
+
+/**
+ * ctrl_groups_load:
+ * @conf:	configuration object
+ * @g:		controllers to fill in the maximum and lead of
+ *
+ * Returns: true if the cache holds exactly these controllers and
+ *	    was written during this boot, false otherwise
+ **/
+static bool ctrl_groups_load(struct light_conf *conf, struct ctrl_groups *g)
+{
+	char buf[CTRL_GROUPS_MAX * (CTRL_NAME_MAX + 32)], boot[CTRL_BOOT_ID_MAX];
+	char *line = buf, *end;
+	int i = 0;
+	burn_path path = ctrl_groups_path(conf, false, "");
+
+	if (!path || file_read_str(path, buf, sizeof(buf)) < 0 ||
+	    !(end = strchr(line, '\n')))
+		return false;
+
+	*end = '\0';
+	if (strcmp(line, ctrl_boot_id(boot)) != 0) {
+		vlog_debug("controllers were cached during another boot");
+		return false;
+	}
+
+	for (line = end + 1; (end = strchr(line, '\n')); line = end + 1, i++) {
+		char name[CTRL_NAME_MAX];
+
+		*end = '\0';
+		if (i == g->n || sscanf(line, "%63s %" SCNd64 " %d", name, &g->ctrl[i].max,
+					&g->ctrl[i].lead) != 3 ||
+		    strcmp(name, g->ctrl[i].name) != 0 ||
+		    g->ctrl[i].lead < 0 || g->ctrl[i].lead >= g->n)
+			return false;
+	}
+
+	return i == g->n;
+}
+
+/**
+ * ctrl_groups_save:
+ * @conf:	configuration object
+ * @g:		controllers to store
+ *
+ * Stores the controllers in the cache, replacing the previous ones
+ * at once. Failing to is harmless.
+ **/
+static void ctrl_groups_save(struct light_conf *conf, const struct ctrl_groups *g)
+{
+	char buf[CTRL_GROUPS_MAX * (CTRL_NAME_MAX + 32)], boot[CTRL_BOOT_ID_MAX], suffix[24];
+	size_t len;
+	burn_path path = ctrl_groups_path(conf, true, "");
+	burn_path tmp = NULL;
+	burn_fd fd = -1;
+
+	len = (size_t) snprintf(buf, sizeof(buf), "%s\n", ctrl_boot_id(boot));
+	for (int i = 0; i < g->n; i++)
+		len += (size_t) snprintf(buf + len, sizeof(buf) - len, "%s %" PRId64 " %d\n",
+					 g->ctrl[i].name, g->ctrl[i].max, g->ctrl[i].lead);
+
+	snprintf(suffix, sizeof(suffix), ".%ld", (long) getpid());
+
+	if (!path || !(tmp = ctrl_groups_path(conf, false, suffix)) ||
+	    (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 ||
+	    write(fd, buf, len) != (ssize_t) len || rename(tmp, path) < 0) {
+		vlog_info("caching controllers: %m");
+		if (tmp)
+			unlink(tmp);
+	}
+}
+
+/**
+ * ctrl_groups:
+ * @conf:	configuration object to work on
+ * @g:		where to store the controllers
+ *
+ * Lists the controllers of the target with their maximum and the
+ * lead of their output. The result is cached as long as the same
+ * controllers are present during one boot, so usually only the
+ * directory and the boot id are read.
+ *
+ * Returns: true on success, false if there are too many controllers
+ **/
+bool ctrl_groups(struct light_conf *conf, struct ctrl_groups *g)
+{
+	const char *name;
+	burn_fd fd = init_sys(conf) ? open(conf->sys_prefix, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+	struct file_dir dir = { .fd = fd };
+
+	if (fd < 0) {
+		vlog_err("open: %m");
+		return false;
+	}
+
+	for (g->n = 0; (name = file_dir_next(&dir)); ) {
+		if (g->n == CTRL_GROUPS_MAX || strlen(name) >= CTRL_NAME_MAX) {
+			vlog_info("too many controllers to group");
+			return false;
+		}
+		strcpy(g->ctrl[g->n++].name, name);
+	}
+
+	if (ctrl_groups_load(conf, g))
+		return true;
+
+	if (!ctrl_groups_scan(conf, g))
+		return false;
+
+	ctrl_groups_save(conf, g);
+	return true;
+}
+
+/**
+ * ctrl_lead:
+ * @g:		controllers of the target
+ * @name:	controller to look up
+ *
+ * Returns: the preferred controller of the output driven by name,
+ *	    or NULL if that is name itself or name is not known
+ **/
+const char *ctrl_lead(const struct ctrl_groups *g, const char *name)
+{
+	for (int i = 0; i < g->n; i++) {
+		if (strcmp(g->ctrl[i].name, name) == 0)
+			return g->ctrl[i].lead != i ? g->ctrl[g->ctrl[i].lead].name : NULL;
+	}
+
+	return NULL;
+}
+
+/**
+ * ctrl_auto_scan:
+ * @conf:	configuration object to work on
+ *
+ * Keeps the controller with the highest max brightness, reading
+ * that of every one, for targets with too many controllers to group.
+ **/
+static void ctrl_auto_scan(struct light_conf *conf)
 {
 	char *next, *prev;
 	burn_dir dir = opendir(conf->sys_prefix);
 
 	if (!dir) {
 		vlog_err("opendir: %m");
-		return false;
+		return;
 	}
 
 	while ((next = ctrl_iter_next(dir))) {
@@ -72,7 +474,7 @@ bool ctrl_auto(struct light_conf *conf)
 				vlog_debug("found (better) controller '%s'", next);
 				conf->cached_max = max;
 				if (prev)
-					free(prev);
+					path_free(prev);
 				continue;
 			} else {
 				vlog_notice("found worse controller '%s'", next);
@@ -83,7 +485,46 @@ bool ctrl_auto(struct light_conf *conf)
 			conf->ctrl = prev;
 		}
 
-		free(next);
+		path_free(next);
+	}
+}
+
+/**
+ * ctrl_auto:
+ * @conf:	configuration object to work on
+ *
+ * Finds the controller with the highest max brightness, among the
+ * preferred one of each output. Stores the name of the controller
+ * and the max brightness value in the configuration object.
+ *
+ * WARNING: will return an allocated string, which
+ *          should be freed after use
+ *
+ * Returns: best controller, or NULL if no suitable controller is found
+ **/
+bool ctrl_auto(struct light_conf *conf)
+{
+	struct ctrl_groups g;
+	int best = -1;
+
+	if (!ctrl_groups(conf, &g)) {
+		ctrl_auto_scan(conf);
+	} else {
+		for (int i = 0; i < g.n; i++) {
+			if (g.ctrl[i].lead == i && g.ctrl[i].max > 0 &&
+			    (best < 0 || g.ctrl[i].max > g.ctrl[best].max))
+				best = i;
+		}
+
+		if (best >= 0 && (conf->ctrl = path_new()) &&
+		    (conf->ctrl = path_append(conf->ctrl, "%s", g.ctrl[best].name)))
+			conf->cached_max = g.ctrl[best].max;
+	}
+
+	/* external displays only when there is no panel */
+	if (!conf->ctrl) {
+		burn_dir dev = ctrl_ddc_dir(conf);
+		conf->ctrl = ctrl_ddc_next(conf, dev, true);
 	}
 
 	if (conf->ctrl) {
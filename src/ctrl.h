@@ -7,8 +7,38 @@
 
 #include "light.h"
 
+#define CTRL_GROUPS_MAX 64
+#define CTRL_NAME_MAX 64
+
+/**
+ * ctrl_group:
+ *
+ * A controller and the one preferred among those driving the same
+ * output, such as a firmware and a native backlight of one panel.
+ **/
+struct ctrl_group {
+	char name[CTRL_NAME_MAX];
+	int64_t max;	/* max brightness, -1 if inaccessible */
+	int lead;	/* index of the preferred controller of the output */
+};
+
+/**
+ * ctrl_groups:
+ *
+ * The controllers of a target, in directory order.
+ **/
+struct ctrl_groups {
+	struct ctrl_group ctrl[CTRL_GROUPS_MAX];
+	int n;
+};
+
 char *ctrl_iter_next(DIR * dir)
 	__attribute__ ((warn_unused_result));
+char *ctrl_ddc_next(struct light_conf *conf, DIR *dir, bool probe)
+	__attribute__ ((warn_unused_result));
+DIR *ctrl_ddc_dir(struct light_conf *conf);
+bool ctrl_groups(struct light_conf *conf, struct ctrl_groups *g);
+const char *ctrl_lead(const struct ctrl_groups *g, const char *name);
 bool ctrl_auto(struct light_conf *conf)
 	__attribute__ ((warn_unused_result));
 
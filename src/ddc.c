@@ -0,0 +1,398 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/i2c-dev.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "light.h"
+#include "ddc.h"
+
+#define DDC_ADDR 0x37
+#define DDC_EDID_ADDR 0x50
+#define DDC_HOST 0x51
+#define DDC_DEST 0x6e
+#define DDC_REPLY_CHK 0x50
+#define DDC_GET_VCP 0x01
+#define DDC_GET_VCP_REPLY 0x02
+#define DDC_SET_VCP 0x03
+#define DDC_VCP_BRIGHTNESS 0x10
+#define DDC_REPLY_NSEC 40000000LL
+#define DDC_GAP_NSEC 50000000LL
+#define DDC_STALE_NSEC 1000000000LL
+#define DDC_BUSES_MAX 16
+
+/**
+ * ddc_bus:
+ *
+ * An opened DDC/CI bus and what is known about the display on it.
+ * A display needs a gap after each command, so the earliest time
+ * for the next one is tracked, and the last read is reused until
+ * it grows stale. A stream bus is a local stand-in for a monitor
+ * that speaks the same bytes over a unix socket, with no addressing.
+ **/
+struct ddc_bus {
+	char name[32];
+	int fd;
+	bool stream;
+	int64_t cur;
+	int64_t max;
+	int64_t t_read;
+	int64_t t_next;
+};
+
+static struct ddc_bus ddc_buses[DDC_BUSES_MAX];
+static int ddc_count = 0;
+
+/**
+ * ddc_now:
+ *
+ * Returns: monotonic time in nanoseconds
+ **/
+static int64_t ddc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * ddc_sleep_until:
+ * @t:		monotonic time in nanoseconds
+ **/
+static void ddc_sleep_until(int64_t t)
+{
+	struct timespec ts = { (time_t) (t / 1000000000), (long) (t % 1000000000) };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/**
+ * ddc_ctrl:
+ * @ctrl:	controller name
+ *
+ * Returns: true if ctrl names a DDC/CI display
+ **/
+bool ddc_ctrl(const char *ctrl)
+{
+	return ctrl && strncmp(ctrl, DDC_PREFIX, strlen(DDC_PREFIX)) == 0;
+}
+
+/**
+ * ddc_bus_open:
+ * @ctrl:	controller name, "ddc:" followed by the i2c device
+ *
+ * Finds the bus of ctrl, opening it on first use.
+ *
+ * Returns: the bus, or NULL on failure
+ **/
+static struct ddc_bus *ddc_bus_open(const char *ctrl)
+{
+	struct ddc_bus *b;
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	const char *name = ctrl + strlen(DDC_PREFIX);
+	struct stat st;
+
+	for (int i = 0; i < ddc_count; i++)
+		if (strcmp(ddc_buses[i].name, name) == 0)
+			return &ddc_buses[i];
+
+	if (ddc_count == DDC_BUSES_MAX || strlen(name) >= sizeof(b->name)) {
+		vlog_err("can't handle DDC/CI display '%s'", ctrl);
+		return NULL;
+	}
+
+	b = &ddc_buses[ddc_count];
+	memset(b, 0, sizeof(*b));
+	strcpy(b->name, name);
+
+	if (snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/%s", path_dev(), name) >=
+	    (int) sizeof(sa.sun_path) || stat(sa.sun_path, &st) < 0) {
+		vlog_debug("stat '%s': %m", sa.sun_path);
+		return NULL;
+	}
+
+	if ((b->stream = S_ISSOCK(st.st_mode))) {
+		if ((b->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0 &&
+		    connect(b->fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+			close(b->fd);
+			b->fd = -1;
+		}
+	} else {
+		b->fd = open(sa.sun_path, O_RDWR | O_CLOEXEC);
+	}
+
+	if (b->fd < 0) {
+		vlog_debug("open '%s': %m", sa.sun_path);
+		return NULL;
+	}
+
+	ddc_count++;
+	return b;
+}
+
+/**
+ * ddc_xfer:
+ * @b:		bus to talk on
+ * @addr:	i2c address of the display
+ * @req:	request to write
+ * @len:	length of req
+ * @reply:	where to read the reply into, or NULL
+ * @rlen:	length of reply
+ *
+ * Runs one transaction, keeping the gaps the display needs
+ * before reading a reply and before the next command.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool ddc_xfer(struct ddc_bus *b, int addr, const uint8_t *req, size_t len,
+		     uint8_t *reply, size_t rlen)
+{
+	bool r;
+
+	ddc_sleep_until(b->t_next);
+
+	if (!b->stream && ioctl(b->fd, I2C_SLAVE, addr) < 0) {
+		vlog_debug("%s: I2C_SLAVE 0x%02x: %m", b->name, addr);
+		return false;
+	}
+
+	r = write(b->fd, req, len) == (ssize_t) len;
+
+	if (r && reply) {
+		if (addr == DDC_ADDR)
+			ddc_sleep_until(ddc_now() + DDC_REPLY_NSEC);
+		r = read(b->fd, reply, rlen) == (ssize_t) rlen;
+	}
+
+	if (!r)
+		vlog_debug("%s: transaction with 0x%02x failed: %m", b->name, addr);
+
+	b->t_next = ddc_now() + DDC_GAP_NSEC;
+	return r;
+}
+
+/**
+ * ddc_checksum:
+ * @init:	initial value
+ * @buf:	bytes to sum up
+ * @len:	number of bytes
+ *
+ * Returns: the XOR of init and all bytes of buf
+ **/
+static uint8_t ddc_checksum(uint8_t init, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		init ^= buf[i];
+	return init;
+}
+
+/**
+ * ddc_read_vcp:
+ * @b:		bus of the display
+ *
+ * Reads the current and maximum brightness of the display.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool ddc_read_vcp(struct ddc_bus *b)
+{
+	uint8_t req[5] = { DDC_HOST, 0x82, DDC_GET_VCP, DDC_VCP_BRIGHTNESS, 0 };
+	uint8_t reply[11];
+
+	req[4] = ddc_checksum(DDC_DEST, req, 4);
+
+	if (!ddc_xfer(b, DDC_ADDR, req, sizeof(req), reply, sizeof(reply)))
+		return false;
+
+	if (reply[1] != 0x88 || reply[2] != DDC_GET_VCP_REPLY ||
+	    reply[4] != DDC_VCP_BRIGHTNESS ||
+	    ddc_checksum(DDC_REPLY_CHK, reply, 10) != reply[10]) {
+		vlog_debug("%s: malformed VCP reply", b->name);
+		return false;
+	}
+
+	if (reply[3] != 0) {
+		vlog_debug("%s: brightness not supported", b->name);
+		return false;
+	}
+
+	b->max = (reply[6] << 8) | reply[7];
+	b->cur = (reply[8] << 8) | reply[9];
+	b->t_read = ddc_now();
+
+	return b->max > 0;
+}
+
+/**
+ * ddc_fetch:
+ * @ctrl:	controller name
+ * @field:	LIGHT_BRIGHTNESS or LIGHT_MAX_BRIGHTNESS
+ *
+ * Both values come from one transaction, so reading the other
+ * one right after is free.
+ *
+ * Returns: the value on success, -errno on failure
+ **/
+int64_t ddc_fetch(const char *ctrl, LIGHT_FIELD field)
+{
+	struct ddc_bus *b = ddc_bus_open(ctrl);
+
+	if (!b)
+		return -ENODEV;
+
+	if ((b->t_read == 0 || ddc_now() - b->t_read > DDC_STALE_NSEC) && !ddc_read_vcp(b)) {
+		vlog_err("reading brightness of '%s' failed", ctrl);
+		return -EIO;
+	}
+
+	return field == LIGHT_MAX_BRIGHTNESS ? b->max : b->cur;
+}
+
+/**
+ * ddc_open:
+ * @ctrl:	controller name
+ *
+ * Returns: a descriptor standing in for the brightness file,
+ *	    or -1 on failure
+ **/
+int ddc_open(const char *ctrl)
+{
+	struct ddc_bus *b = ddc_bus_open(ctrl);
+	int fd = b ? dup(b->fd) : -1;
+
+	if (fd < 0)
+		vlog_err("opening DDC/CI display '%s' failed", ctrl);
+
+	return fd;
+}
+
+/**
+ * ddc_put:
+ * @ctx:	controller name
+ * @vals:	frame with the brightness to set
+ * @n:		number of values, only the first is used
+ *
+ * Frame writer for file_write(), one transaction per frame.
+ *
+ * Returns: true on success, false on failure
+ **/
+bool ddc_put(void *ctx, const int64_t *vals, int n)
+{
+	struct ddc_bus *b = ddc_bus_open(ctx);
+	uint8_t req[7] = { DDC_HOST, 0x84, DDC_SET_VCP, DDC_VCP_BRIGHTNESS, 0, 0, 0 };
+
+	if (!b || n < 1)
+		return false;
+
+	req[4] = (uint8_t) (vals[0] >> 8);
+	req[5] = (uint8_t) vals[0];
+	req[6] = ddc_checksum(DDC_DEST, req, 6);
+
+	if (!ddc_xfer(b, DDC_ADDR, req, sizeof(req), NULL, 0)) {
+		vlog_err("setting brightness of '%s' failed", (char *) ctx);
+		return false;
+	}
+
+	b->cur = vals[0];
+	return true;
+}
+
+/**
+ * ddc_adapter:
+ * @name:	i2c device, such as "i2c-4"
+ *
+ * Tells the DDC channel of a display connector from the other buses,
+ * such as SMBus, memory SPD or touchpads, by sysfs alone. The connector
+ * links its DDC bus as ddc, and a DisplayPort AUX channel bus is a
+ * child of its connector.
+ *
+ * Returns: true if the bus belongs to a display connector
+ **/
+static bool ddc_adapter(const char *name)
+{
+	char link[PATH_MAX];
+	burn_path drm = path_new();
+	burn_dir dir = NULL;
+	struct dirent *e;
+
+	if (!drm || !(drm = path_append(drm, "%s/class/drm", path_sysfs())) ||
+	    !(dir = opendir(drm)))
+		return false;
+
+	while ((e = readdir(dir))) {
+		burn_path p = NULL;
+		const char *base;
+		ssize_t len;
+
+		/* connectors are named like card0-eDP-1 */
+		if (e->d_name[0] == '.' || !strchr(e->d_name, '-') ||
+		    !(p = path_new()) || !(p = path_append(p, "%s/%s/", drm, e->d_name)))
+			continue;
+
+		if (!(p = path_append(p, "%s", name)))
+			continue;
+		if (access(p, F_OK) == 0)
+			return true;
+
+		strcpy(strrchr(p, '/'), "/ddc");
+		if ((len = readlink(p, link, sizeof(link) - 1)) < 0)
+			continue;
+		link[len] = '\0';
+		base = strrchr(link, '/');
+		if (strcmp(base ? base + 1 : link, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * ddc_probe:
+ * @ctrl:	controller name
+ *
+ * Checks whether there is a display with an EDID on the bus
+ * that reports its brightness over DDC/CI. Buses that are not
+ * the DDC channel of a display connector are never written to,
+ * and other devices are never sent a DDC/CI command.
+ *
+ * Returns: 1 if it does, 0 if it does not, -1 if the bus can't be opened
+ **/
+int ddc_probe(const char *ctrl)
+{
+	static const uint8_t header[8] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+	const uint8_t offset = 0;
+	uint8_t edid[8];
+	struct ddc_bus *b = NULL;
+
+	if (!ddc_adapter(ctrl + strlen(DDC_PREFIX))) {
+		vlog_debug("%s: not a display connector", ctrl);
+		return 0;
+	}
+
+	if (!(b = ddc_bus_open(ctrl)))
+		return -1;
+
+	if (!b->stream &&
+	    (!ddc_xfer(b, DDC_EDID_ADDR, &offset, 1, edid, sizeof(edid)) ||
+	     memcmp(edid, header, sizeof(header)) != 0)) {
+		vlog_debug("%s: no EDID", ctrl);
+		return 0;
+	}
+
+	return ddc_read_vcp(b) ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef DDC_H
+#define DDC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "light.h"
+
+#define DDC_PREFIX "ddc:"
+
+bool ddc_ctrl(const char *ctrl);
+int64_t ddc_fetch(const char *ctrl, LIGHT_FIELD field);
+int ddc_open(const char *ctrl);
+bool ddc_put(void *ctx, const int64_t *vals, int n);
+int ddc_probe(const char *ctrl);
+
+#endif /* DDC_H */
@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "light.h"
+#include "file.h"
+#include "exec.h"
+#include "shm.h"
+#include "dither.h"
+
+#define DITHER_RATE_MAX 200
+#define DITHER_RATE_MIN 25
+#define DITHER_SLACK_NSEC 50000
+#define DITHER_PERIOD_MSEC 16
+#define DITHER_TRIGGER "pattern"
+#define DITHER_TRIGGER_MAX 4096
+
+static volatile sig_atomic_t dither_stop = 0;
+
+static void dither_signal(int sig)
+{
+	(void) sig;
+	dither_stop = 1;
+}
+
+/**
+ * dither_trigger:
+ * @conf:	configuration object of an LED
+ * @active:	whether the pattern trigger must be the active one
+ *
+ * Returns: true if the LED has the pattern trigger, and it is active if asked
+ **/
+static bool dither_trigger(struct light_conf *conf, bool active)
+{
+	char buf[DITHER_TRIGGER_MAX];
+	burn_path path = NULL;
+	size_t len = strlen(DITHER_TRIGGER);
+
+	if (conf->target != LIGHT_KEYBOARD ||
+	    !(path = light_path_new(conf, LIGHT_TRIGGER)) ||
+	    file_read_str(path, buf, sizeof(buf)) <= 0)
+		return false;
+
+	/* the list is separated by spaces, the active one is in brackets */
+	for (char *s = buf; (s = strstr(s, DITHER_TRIGGER)); s += len) {
+		bool open = s > buf && s[-1] == '[';
+
+		if ((s == buf || s[-1] == ' ' || open) &&
+		    (open ? s[len] == ']' : !active && strchr(" \n", s[len]) != NULL))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * dither_put:
+ * @conf:	configuration object of an LED
+ * @field:	field to write
+ * @str:	string to write into it
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool dither_put(struct light_conf *conf, LIGHT_FIELD field, const char *str)
+{
+	burn_path path = light_path_new(conf, field);
+	burn_fd fd = path ? file_open(path, O_WRONLY) : -1;
+
+	return fd >= 0 && file_puts(fd, str);
+}
+
+/**
+ * dither_active:
+ * @conf:	configuration object
+ *
+ * Returns: true if a pattern left by a dithered write runs on the LED
+ **/
+bool dither_active(struct light_conf *conf)
+{
+	return dither_trigger(conf, true);
+}
+
+/**
+ * dither_release:
+ * @conf:	configuration object
+ *
+ * Stops the pattern a previous dithered write left running on an
+ * LED, so it does not fight the new brightness.
+ *
+ * Returns: true on success, false on failure
+ **/
+bool dither_release(struct light_conf *conf)
+{
+	if (!dither_active(conf))
+		return true;
+
+	vlog_info("stopping the pattern of '%s'", conf->ctrl);
+	return dither_put(conf, LIGHT_TRIGGER, "none");
+}
+
+/**
+ * dither_play:
+ * @conf:	configuration object
+ * @pattern:	"brightness duration" pairs for the pattern trigger
+ * @repeat:	number of times to run the pattern, -1 for ever
+ *
+ * Hands a pattern to the pattern trigger of an LED, in which the
+ * brightness moves linearly from each pair to the next one over
+ * its duration in milliseconds, and no process is left running.
+ *
+ * Returns: true if the pattern runs, false otherwise
+ **/
+bool dither_play(struct light_conf *conf, const char *pattern, int64_t repeat)
+{
+	char buf[24];
+
+	if (!dither_trigger(conf, false))
+		return false;
+
+	snprintf(buf, sizeof(buf), "%" PRId64, repeat);
+
+	/* a new repeat count restarts the pattern, so it goes first */
+	if (!dither_put(conf, LIGHT_TRIGGER, DITHER_TRIGGER) ||
+	    !dither_put(conf, LIGHT_REPEAT, buf) ||
+	    !dither_put(conf, LIGHT_PATTERN, pattern))
+		return false;
+
+	vlog_info("'%s' runs pattern '%s'", conf->ctrl, pattern);
+	return true;
+}
+
+/**
+ * dither_pattern:
+ * @conf:	configuration object
+ * @fine:	brightness in 1/DITHER_SCALE raw steps
+ *
+ * Hands dithering to the pattern trigger of an LED, which then
+ * alternates between the two neighbouring raw levels in the kernel
+ * with a period of DITHER_PERIOD_MSEC, and no process left running.
+ *
+ * Returns: true if the pattern runs, false if the LED has no such trigger
+ **/
+bool dither_pattern(struct light_conf *conf, int64_t fine)
+{
+	char pattern[128];
+	int64_t lo = fine / DITHER_SCALE;
+	int64_t hi_ms = ((fine % DITHER_SCALE) * DITHER_PERIOD_MSEC + DITHER_SCALE / 2) / DITHER_SCALE;
+
+	if (hi_ms < 1)
+		hi_ms = 1;
+	else if (hi_ms > DITHER_PERIOD_MSEC - 1)
+		hi_ms = DITHER_PERIOD_MSEC - 1;
+
+	/* hold each level, then step to the other one without a ramp */
+	snprintf(pattern, sizeof(pattern), "%" PRId64 " %" PRId64 " %" PRId64 " 0 %"
+		 PRId64 " %" PRId64 " %" PRId64 " 0", lo, DITHER_PERIOD_MSEC - hi_ms, lo,
+		 lo + 1, hi_ms, lo + 1);
+
+	return dither_play(conf, pattern, -1);
+}
+
+/**
+ * dither_cpu:
+ *
+ * Returns: CPU time used by the process in nanoseconds
+ **/
+static int64_t dither_cpu(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return ((int64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+/**
+ * dither_hold:
+ * @fd:		opened brightness
+ * @fine:	brightness in 1/DITHER_SCALE raw steps
+ * @latency:	write latency in usecs, 0 if unknown
+ * @key:	shared memory key the brightness was published under, or NULL
+ *
+ * Holds a brightness between two raw levels until interrupted, by
+ * picking one of them on every tick of an absolute timer, carrying
+ * the error over to the next tick. Only changes are written, at no
+ * more than half the rate the device keeps up with. Another write
+ * published under key takes over and ends the hold. The wakeups,
+ * writes and CPU time it cost are logged at the end.
+ *
+ * Returns: true when stopped, false on failure
+ **/
+bool dither_hold(int fd, int64_t fine, int64_t latency, const char *key)
+{
+	struct sigaction sa = { .sa_handler = dither_signal };
+	struct shm_value own, cur;
+	struct timespec t;
+	int64_t rate = latency > 0 ? 1000000 / (2 * latency) : DITHER_RATE_MAX;
+	int64_t iter, residue = 0, last = -1, wakeups = 0, writes = 0;
+	int64_t start, cpu = dither_cpu(), elapsed;
+	int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+	bool owned = key && shm_read(key, INT64_MAX, &own);
+	bool ret = true;
+
+	if (rate > DITHER_RATE_MAX)
+		rate = DITHER_RATE_MAX;
+	if (rate < DITHER_RATE_MIN) {
+		vlog_warning("device too slow to dither, rounding");
+		last = (fine + DITHER_SCALE / 2) / DITHER_SCALE;
+		return file_rewrite(fd, &last, 1);
+	}
+	iter = 1000000000 / rate;
+
+	/* let other writers in, they end the hold through key */
+	if (lockf(fd, F_ULOCK, 0) < 0)
+		vlog_debug("lockf: %m");
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* ticks must be on time for the levels to blend */
+	if (prctl(PR_SET_TIMERSLACK, DITHER_SLACK_NSEC, 0, 0, 0) < 0)
+		vlog_warning("prctl: %m");
+
+	vlog_info("dithering at %" PRId64 " Hz until interrupted", rate);
+	vlog_flush();
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	start = (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+
+	while (!dither_stop) {
+		int64_t v = fine + residue, raw = v / DITHER_SCALE;
+
+		residue = v - raw * DITHER_SCALE;
+		if (raw != last) {
+			if (!(ret = file_rewrite(fd, &raw, 1)))
+				break;
+			last = raw;
+			writes++;
+		}
+
+		t.tv_nsec += iter;
+		if (t.tv_nsec >= 1000000000) {
+			t.tv_sec += 1;
+			t.tv_nsec -= 1000000000;
+		}
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+			continue;
+		wakeups++;
+
+		if (owned && shm_read(key, INT64_MAX, &cur) && cur.start_ns != own.start_ns) {
+			vlog_info("brightness changed by another write, stopping");
+			break;
+		}
+	}
+
+	if (dither_stop) {
+		last = (fine + DITHER_SCALE / 2) / DITHER_SCALE;
+		ret = file_rewrite(fd, &last, 1);
+	}
+
+	if (slack >= 0)
+		prctl(PR_SET_TIMERSLACK, (unsigned long) slack, 0, 0, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	elapsed = (int64_t) t.tv_sec * 1000000000 + t.tv_nsec - start;
+	cpu = dither_cpu() - cpu;
+
+	if (elapsed > 0)
+		vlog_notice("dithered for %" PRId64 " ms: %" PRId64 " wakeups/s, %" PRId64
+			    " writes/s, %.3f%% cpu", elapsed / 1000000,
+			    wakeups * 1000000000 / elapsed, writes * 1000000000 / elapsed,
+			    100.0 * (double) cpu / (double) elapsed);
+
+	return ret;
+}
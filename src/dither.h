@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "light.h"
+
+/* dithered values are in 1/DITHER_SCALE raw steps */
+#define DITHER_SCALE 256
+
+bool dither_active(struct light_conf *conf);
+bool dither_release(struct light_conf *conf);
+bool dither_play(struct light_conf *conf, const char *pattern, int64_t repeat);
+bool dither_pattern(struct light_conf *conf, int64_t fine);
+bool dither_hold(int fd, int64_t fine, int64_t latency, const char *key);
+
+#endif /* DITHER_H */
@@ -1,163 +1,1090 @@
 /* SPDX-License-Identifier: GPL-3.0-only */
 
 #include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
 #include "burno.h"
 #include "vlog.h"
 #include "path.h"
+#include "cfg.h"
 #include "info.h"
 #include "ctrl.h"
+#include "init.h"
 #include "light.h"
 #include "value.h"
 #include "file.h"
 #include "exec.h"
+#include "power.h"
+#include "als.h"
+#include "sched.h"
+#include "input.h"
+#include "ddc.h"
+#include "shm.h"
+#include "follow.h"
+#include "dither.h"
+#include "logind.h"
+#include "usage.h"
+#include "anim.h"
+#include "thermal.h"
+
+#define EXEC_RATE_MIN 10
+#define EXEC_RATE_MAX 120
+#define EXEC_TIMEOUT_MIN 100000
+#define EXEC_CALIBRATE_WRITES 8
+#define EXEC_DEFER_NSEC 500000000
+#define EXEC_TRIGGER_MAX 4096
+#define EXEC_DELTA_MODES (LIGHT_PERCENT_EXPONENTIAL + 1)
+#define EXEC_DELTA_LOCK 0	/* byte of the mailbox locked while it is accessed */
+#define EXEC_DELTA_OWNER 1	/* byte of the mailbox locked while steps are applied */
+#define EXEC_DELTA_EXPIRE_NSEC 1000000000LL
 
 static int64_t exec_get_min(struct light_conf *conf);
+static int64_t exec_get_cap(struct light_conf *conf, int64_t mincap, int64_t max);
+static int exec_fetch_color(struct light_conf *conf, int64_t *vals);
 static bool exec_write(struct light_conf *conf, LIGHT_FIELD field, int64_t val_old, int64_t val_new);
 static bool exec_restore(struct light_conf *conf);
+static bool exec_visible(struct light_conf *conf);
+
+/* writes left out because the value was already there */
+static int exec_skipped = 0;
+
+/**
+ * exec_skip:
+ * @conf:	configuration object
+ * @val:	raw value the controller already holds
+ *
+ * Counts a write that would not change anything and is left out,
+ * so the device is neither opened nor locked nor written.
+ *
+ * Returns: true
+ **/
+static bool exec_skip(struct light_conf *conf, int64_t val)
+{
+	exec_skipped++;
+	vlog_notice("'%s' already holds %" PRId64 ", not writing it", conf->ctrl, val);
+	return true;
+}
+
+/**
+ * exec_fade_init:
+ * @conf:	configuration object
+ * @fade:	fade parameters to fill in
+ *
+ * Sizes a fade for the controller from its cached write latency:
+ * the frame rate leaves the device idle at least as long as a write
+ * takes, and a write stalling well past the estimate ends the fade.
+ * Smooth writes are further limited by the policy of the current
+ * power state. Without either, the file_write() defaults are used.
+ *
+ * Returns: the power state the policy was picked for
+ **/
+static POWER_STATE exec_fade_init(struct light_conf *conf, struct file_fade *fade)
+{
+	POWER_STATE power = POWER_UNKNOWN;
+	int64_t latency = light_fetch(conf, LIGHT_LATENCY);
+
+	fade->usec = conf->usec;
+	fade->rate = 0;
+	fade->timeout = 0;
+	fade->slack = 0;
+	fade->latency = 0;
+	fade->put = NULL;
+	fade->ctx = NULL;
+	fade->clock = NULL;
+	fade->dither = 0;
+	fade->curve = FILE_CURVE_LINEAR;
+	fade->start_ns = 0;
+
+	if (latency > 0) {
+		fade->rate = 1000000 / (2 * latency);
+		if (fade->rate < EXEC_RATE_MIN)
+			fade->rate = EXEC_RATE_MIN;
+		else if (fade->rate > EXEC_RATE_MAX)
+			fade->rate = EXEC_RATE_MAX;
+
+		fade->timeout = 10 * latency;
+		if (fade->timeout < EXEC_TIMEOUT_MIN)
+			fade->timeout = EXEC_TIMEOUT_MIN;
+	}
+
+	/* nobody sees a fade on a device that is off */
+	if (fade->usec > 0 && !exec_visible(conf)) {
+		vlog_info("'%s' is not visible, writing at once", conf->ctrl);
+		fade->usec = 0;
+	}
+
+	/* only smooth writes have frames to save */
+	if (fade->usec > 0) {
+		power = power_state();
+		power_policy(power, fade);
+	}
+
+	vlog_info("write latency %" PRId64 " usecs, fading at %" PRId64 " Hz on %s power",
+		  latency, fade->rate, power_name(power));
+
+	return power;
+}
+
+/**
+ * exec_latency_save:
+ * @conf:	configuration object
+ * @sample:	measured write latency in usecs
+ * @replace:	whether to discard the previous estimate
+ *
+ * Folds sample into the rolling latency estimate in the cache.
+ * The cache file is only rewritten when the estimate moved.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_latency_save(struct light_conf *conf, int64_t sample, bool replace)
+{
+	int64_t est, old = light_fetch(conf, LIGHT_LATENCY);
+
+	if (sample <= 0)
+		sample = 1;
+
+	if (old <= 0 || replace)
+		est = sample;
+	else
+		est = (old * 7 + sample) / 8;
+
+	if (old > 0 && llabs(est - old) <= old / 8)
+		return true;
+
+	vlog_info("write latency estimate: %" PRId64 " usecs", est);
+	return exec_write(conf, LIGHT_LATENCY, old, est);
+}
+
+/**
+ * exec_get_max:
+ *
+ * Determines max value from cache, or by fetching it.
+ *
+ * Returns: negative value on failure, raw max value on success
+ **/
+static int64_t exec_get_max(struct light_conf *conf)
+{
+	if (conf->cached_max == 0)
+		conf->cached_max = light_fetch(conf, LIGHT_MAX_BRIGHTNESS);
+	return conf->cached_max;
+}
+
+/**
+ * exec_cached:
+ * @field:	field to check
+ *
+ * Returns: true if the field is stored in the cache, false if in sysfs
+ **/
+static bool exec_cached(LIGHT_FIELD field)
+{
+	return field == LIGHT_MIN_CAP || field == LIGHT_SAVERESTORE ||
+	       field == LIGHT_LATENCY || field == LIGHT_DDC || field == LIGHT_DELTA;
+}
+
+/**
+ * exec_ddc:
+ * @conf:	configuration object
+ * @field:	field to access
+ *
+ * Returns: true if the field lives on a DDC/CI display, not in sysfs
+ **/
+static bool exec_ddc(struct light_conf *conf, LIGHT_FIELD field)
+{
+	return (field == LIGHT_BRIGHTNESS || field == LIGHT_MAX_BRIGHTNESS) &&
+	       init_ctrl(conf) && ddc_ctrl(conf->ctrl);
+}
+
+/**
+ * exec_logind:
+ * @conf:	configuration object
+ * @field:	field to access
+ *
+ * Unprivileged callers that can't write the brightness themselves
+ * write it through logind, if they have an active session.
+ *
+ * Returns: true if the field is written through logind
+ **/
+static bool exec_logind(struct light_conf *conf, LIGHT_FIELD field)
+{
+	burn_path path = NULL;
+
+	if (field != LIGHT_BRIGHTNESS || geteuid() == 0 || exec_ddc(conf, field) ||
+	    !(path = light_path_new(conf, field)))
+		return false;
+
+	return faccessat(AT_FDCWD, path, W_OK, AT_EACCESS) != 0 && logind_session();
+}
+
+/**
+ * exec_visible:
+ * @conf:	configuration object
+ *
+ * Checks whether the brightness can be seen: not while the panel
+ * of a backlight is powered down, nor while a trigger other than
+ * the pattern of a dithered write drives an LED.
+ *
+ * Returns: false if the device is known not to show its brightness
+ **/
+static bool exec_visible(struct light_conf *conf)
+{
+	char buf[EXEC_TRIGGER_MAX], *s, *e;
+	burn_path path = NULL;
+
+	if (exec_ddc(conf, LIGHT_BRIGHTNESS))
+		return true;
+
+	/* anything but FB_BLANK_UNBLANK, a missing bl_power is visible */
+	if (conf->target == LIGHT_BACKLIGHT)
+		return light_fetch(conf, LIGHT_BL_POWER) <= 0;
+
+	if (!(path = light_path_new(conf, LIGHT_TRIGGER)) ||
+	    file_read_str(path, buf, sizeof(buf)) <= 0 ||
+	    !(s = strchr(buf, '[')) || !(e = strchr(s, ']')))
+		return true;
+
+	*e = '\0';
+	return strcmp(s + 1, "none") == 0 || strcmp(s + 1, "pattern") == 0;
+}
+
+/**
+ * exec_defer:
+ * @conf:	configuration object
+ *
+ * Waits until the device shows its brightness again. Neither
+ * bl_power nor the trigger of an LED notify their readers, so
+ * they are checked every EXEC_DEFER_NSEC.
+ **/
+static void exec_defer(struct light_conf *conf)
+{
+	const struct timespec t = { .tv_sec = 0, .tv_nsec = EXEC_DEFER_NSEC };
+
+	if (exec_visible(conf))
+		return;
+
+	vlog_notice("'%s' is not visible, waiting for it", conf->ctrl);
+	vlog_flush();
+
+	while (!exec_visible(conf))
+		nanosleep(&t, NULL);
+}
+
+/**
+ * exec_sink:
+ * @conf:	configuration object
+ * @field:	field being written
+ * @fade:	fade to route the frames of
+ *
+ * Hands the frames of a write to a DDC/CI display or to logind
+ * to their backend, file_write() prints them into the fd otherwise.
+ **/
+static void exec_sink(struct light_conf *conf, LIGHT_FIELD field, struct file_fade *fade)
+{
+	if (exec_ddc(conf, field)) {
+		fade->put = ddc_put;
+		fade->ctx = conf->ctrl;
+	} else if (exec_logind(conf, field)) {
+		fade->put = logind_put;
+		fade->ctx = conf;
+	}
+}
+
+/**
+ * exec_sink_sync:
+ * @conf:	configuration object
+ * @field:	field that was written
+ *
+ * Waits for a backend to confirm the frames it was handed.
+ *
+ * Returns: true if they were all written, false otherwise
+ **/
+static bool exec_sink_sync(struct light_conf *conf, LIGHT_FIELD field)
+{
+	return exec_logind(conf, field) ? logind_sync() : true;
+}
+
+/**
+ * exec_open:
+ * @conf:	configuration object
+ * @field:	field to access
+ * @flags:	flags to pass to open
+ *
+ * Opens a given field with the flags specified.
+ *
+ * Returns: an fd on success, negative value on failure
+ **/
+static int exec_open(struct light_conf *conf, LIGHT_FIELD field, int flags)
+{
+	burn_path path = NULL;
+
+	if (exec_ddc(conf, field))
+		return ddc_open(conf->ctrl);
+	if (exec_logind(conf, field))
+		return logind_open();
+
+	if (flags != O_RDONLY && exec_cached(field) && !init_cache(conf, true))
+		return -1;
+
+	path = light_path_new(conf, field);
+	return path ? file_open(path, flags) : -1;
+}
+
+/**
+ * exec_get_color:
+ * @conf:	configuration object
+ * @max:	maximum raw value
+ *
+ * Prints the color components of a multicolor LED, comma separated,
+ * in the order given by its multi_index.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_get_color(struct light_conf *conf, int64_t max)
+{
+	int64_t vals[LIGHT_COLORS_MAX];
+	int n = exec_fetch_color(conf, vals);
+
+	if (n < 0)
+		return false;
+
+	for (int k = 0; k < n; k++) {
+		int64_t val = value_from_raw(conf->val_mode, vals[k], max);
+		const char *sep = k + 1 < n ? "," : "\n";
+
+		if (conf->val_mode == LIGHT_RAW)
+			printf("%" PRId64 "%s", val, sep);
+		else
+			printf("%.2f%s", ((double) val / 100.00), sep);
+	}
+
+	return true;
+}
+
+/**
+ * exec_print:
+ * @conf:	configuration object
+ * @raw_val:	raw value to print
+ * @max:	maximum raw value
+ *
+ * Prints a value in the value mode of conf.
+ **/
+static void exec_print(struct light_conf *conf, int64_t raw_val, int64_t max)
+{
+	int64_t val = value_from_raw(conf->val_mode, raw_val, max);
+
+	if (conf->val_mode == LIGHT_RAW)
+		printf("%" PRId64 "\n", val);
+	else
+		printf("%.2f\n", ((double) val / 100.00));
+}
+
+/**
+ * exec_shm_key:
+ * @conf:	configuration object
+ * @key:	where to store the key
+ * @ctrl:	whether to key by controller or by target alone
+ *
+ * Returns: true if the key fits, false otherwise
+ **/
+static bool exec_shm_key(struct light_conf *conf, char *key, bool ctrl)
+{
+	const char *tgt = conf->target == LIGHT_KEYBOARD ? "leds" : "backlight";
+
+	if (!ctrl)
+		return snprintf(key, SHM_KEY_MAX, "%s", tgt) < SHM_KEY_MAX;
+	return snprintf(key, SHM_KEY_MAX, "%s/%s", tgt, conf->ctrl) < SHM_KEY_MAX;
+}
+
+/**
+ * exec_publish:
+ * @conf:	configuration object
+ * @from:	raw value the write starts at
+ * @to:		raw value the write ends at
+ * @max:	maximum raw value, 0 if unknown
+ * @usec:	duration of the write
+ *
+ * Publishes the brightness of the controller in shared memory,
+ * also as that of the target when it was chosen automatically.
+ * Failing to publish is harmless, readers fall back to sysfs.
+ **/
+static void exec_publish(struct light_conf *conf, int64_t from, int64_t to,
+			 int64_t max, int64_t usec)
+{
+	char key[SHM_KEY_MAX];
+
+	if (exec_shm_key(conf, key, true))
+		shm_publish(key, from, to, max, usec);
+	if (conf->ctrl_mode == LIGHT_CTRL_AUTO && exec_shm_key(conf, key, false))
+		shm_publish(key, from, to, max, usec);
+}
+
+/**
+ * exec_get_fast:
+ * @conf:	configuration object
+ *
+ * Prints the brightness or maximum from shared memory while a fade
+ * is still running, when sysfs lags behind it anyway. This needs
+ * neither sysfs nor picking a controller. Outside of fades the value
+ * is read from sysfs, as anything may have changed it since.
+ *
+ * Returns: true if the value was printed, false to read it from sysfs
+ **/
+static bool exec_get_fast(struct light_conf *conf)
+{
+	char key[SHM_KEY_MAX];
+	struct shm_value v;
+
+	if (conf->field != LIGHT_BRIGHTNESS && conf->field != LIGHT_MAX_BRIGHTNESS)
+		return false;
+
+	if (!exec_shm_key(conf, key, conf->ctrl != NULL) ||
+	    !shm_read(key, 0, &v) ||
+	    (v.max <= 0 && (conf->val_mode != LIGHT_RAW || conf->field == LIGHT_MAX_BRIGHTNESS)))
+		return false;
+
+	vlog_info("read '%s' from shared memory, %" PRId64 " msecs old", key, v.age_ns / 1000000);
+	exec_print(conf, conf->field == LIGHT_BRIGHTNESS ? v.cur : v.max, v.max);
+
+	return true;
+}
+
+/**
+ * exec_get:
+ * @conf:	configuration object
+ * @max:	maximum raw value
+ *
+ * Executes the get operation, printing the appropriate field to standard out.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_get(struct light_conf *conf)
+{
+	int64_t raw_val, max = 0;
+
+	/* raw values are printed as they are read */
+	if ((conf->val_mode != LIGHT_RAW || conf->field == LIGHT_MAX_BRIGHTNESS) &&
+	    (max = exec_get_max(conf)) < 0)
+		return false;
+
+	switch (conf->field) {
+	case LIGHT_BRIGHTNESS:
+		raw_val = light_fetch(conf, LIGHT_BRIGHTNESS);
+		break;
+	case LIGHT_MAX_BRIGHTNESS:
+		raw_val = max;
+		break;
+	case LIGHT_MIN_CAP:
+		raw_val = exec_get_min(conf);
+		break;
+	case LIGHT_MULTI_INTENSITY:
+		return exec_get_color(conf, max);
+	case LIGHT_SAVERESTORE:
+		return true;
+	default:
+		return false;
+	}
+
+	if (raw_val < 0)
+		return false;
+
+	exec_print(conf, raw_val, max);
+
+	return true;
+}
+
+/**
+ * exec_dither:
+ * @conf:	configuration object to operate on
+ * @fd:		opened brightness
+ * @fine:	brightness in 1/DITHER_SCALE raw steps
+ * @latency:	write latency in usecs, 0 if unknown
+ *
+ * Keeps the brightness between two raw levels, in the kernel for
+ * LEDs with a pattern trigger and in the foreground otherwise.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_dither(struct light_conf *conf, int fd, int64_t fine, int64_t latency)
+{
+	char key[SHM_KEY_MAX];
+	int64_t raw = (fine + DITHER_SCALE / 2) / DITHER_SCALE;
+
+	if (dither_pattern(conf, fine))
+		return true;
+
+	if (exec_logind(conf, LIGHT_BRIGHTNESS)) {
+		vlog_warning("can't hold '%s' between levels through logind, rounding", conf->ctrl);
+		return logind_put(conf, &raw, 1) && logind_sync();
+	}
+
+	if (conf->ctrl_mode == LIGHT_CTRL_ALL) {
+		vlog_warning("can't hold '%s' between levels with -e, rounding", conf->ctrl);
+		return file_rewrite(fd, &raw, 1);
+	}
+
+	return dither_hold(fd, fine, latency,
+			   exec_shm_key(conf, key, true) ? key : NULL);
+}
+
+/**
+ * exec_target:
+ * @conf:	configuration object to operate on
+ * @curr_raw:	raw value the field holds
+ * @max:	maximum raw value
+ * @mincap:	minimum raw value
+ * @maxcap:	highest raw value to go to
+ * @fine:	where to store the dithered target, -1 if there is none
+ *
+ * Returns: the raw value to write, or -1 for an invalid operation
+ **/
+static int64_t exec_target(struct light_conf *conf, int64_t curr_raw, int64_t max,
+			   int64_t mincap, int64_t maxcap, int64_t *fine)
+{
+	int64_t new_value = conf->value;
+	int64_t curr_value = value_from_raw(conf->val_mode, curr_raw, max);
+	int64_t new_raw;
+
+	*fine = -1;
+
+	if (conf->field == LIGHT_BRIGHTNESS) {
+		switch (conf->op_mode) {
+		case LIGHT_SUB:
+			/* val is unsigned so we need to get back to >= 0 */
+			if (new_value > curr_value)
+				new_value = -curr_value;
+			else
+				new_value = -new_value;
+			/* FALLTHRU */
+		case LIGHT_ADD:
+			new_value += curr_value;
+			break;
+		case LIGHT_SET:
+			break;
+		default:
+			return -1;
+		}
+	} else if (conf->field != LIGHT_MIN_CAP) {
+		return -1;
+	}
+
+	new_raw = value_to_raw(conf->val_mode, new_value, max);
+
+	/* Force any increment to result in some change, however small */
+	if (conf->op_mode == LIGHT_ADD && new_raw <= curr_raw)
+		new_raw += 1;
+
+	new_raw = value_clamp(new_raw, mincap, maxcap);
+
+	if (conf->dither && !exec_ddc(conf, conf->field)) {
+		double raw = value_to_raw_fine(conf->val_mode, new_value, max);
+
+		*fine = value_clamp((int64_t) (raw * DITHER_SCALE + 0.5),
+				    mincap * DITHER_SCALE, maxcap * DITHER_SCALE);
+		if (*fine % DITHER_SCALE == 0)
+			*fine = -1;
+		else
+			new_raw = (*fine + DITHER_SCALE / 2) / DITHER_SCALE;
+	}
+
+	return new_raw;
+}
+
+/**
+ * exec_unchanged:
+ * @conf:	configuration object to operate on
+ * @curr_raw:	raw value the field holds
+ * @new_raw:	raw value to write
+ * @fine:	dithered target, or -1
+ * @max:	maximum raw value
+ *
+ * Returns: true if the write is left out because it would change nothing
+ **/
+static bool exec_unchanged(struct light_conf *conf, int64_t curr_raw, int64_t new_raw,
+			   int64_t fine, int64_t max)
+{
+	/* a running pattern shows another value than the one read */
+	if (fine >= 0 || new_raw != curr_raw ||
+	    (conf->field == LIGHT_BRIGHTNESS && dither_active(conf)))
+		return false;
+
+	if (conf->field == LIGHT_BRIGHTNESS)
+		exec_publish(conf, curr_raw, curr_raw, max, 0);
+	return exec_skip(conf, curr_raw);
+}
+
+/**
+ * exec_set:
+ * @conf:	configuration object to operate on
+ *
+ * Sets the minimum cap or brightness value. A dithered brightness
+ * is faded to in finer steps than the raw levels and then held
+ * between them.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_set(struct light_conf *conf)
+{
+	int64_t new_raw, max, maxcap, curr_raw = -1, mincap = 0, fine = -1;
+	struct file_fade fade;
+	struct follow *followers = NULL;
+	POWER_STATE power;
+	bool written;
+	burn_fd fd = -1;
+
+	if (conf->field == LIGHT_MIN_CAP)
+		curr_raw = exec_get_min(conf);
+	else
+		mincap = exec_get_min(conf);
+
+	if (conf->field != LIGHT_MIN_CAP)
+		curr_raw = light_fetch(conf, conf->field);
+
+	if (curr_raw < 0)
+		return false;
+
+	if ((max = exec_get_max(conf)) < 0)
+		return false;
+
+	maxcap = conf->field == LIGHT_BRIGHTNESS ? exec_get_cap(conf, mincap, max) : max;
+
+	vlog_notice("specified value: %" PRId64, conf->value);
+	vlog_notice("current value: %" PRId64, value_from_raw(conf->val_mode, curr_raw, max));
+
+	/* the unlocked read only tells whether there is anything to write */
+	if ((new_raw = exec_target(conf, curr_raw, max, mincap, maxcap, &fine)) < 0)
+		return false;
+	if (exec_unchanged(conf, curr_raw, new_raw, fine, max))
+		return true;
+
+	if ((fd = exec_open(conf, conf->field, O_WRONLY)) < 0)
+		return false;
+
+	/* another writer may have moved the value before the lock was taken */
+	curr_raw = conf->field == LIGHT_MIN_CAP ? exec_get_min(conf) :
+						  light_fetch(conf, conf->field);
+	if (curr_raw < 0 ||
+	    (new_raw = exec_target(conf, curr_raw, max, mincap, maxcap, &fine)) < 0)
+		return false;
+	if (exec_unchanged(conf, curr_raw, new_raw, fine, max))
+		return true;
+
+	if (conf->field == LIGHT_BRIGHTNESS && !dither_release(conf))
+		return false;
+
+	power = exec_fade_init(conf, &fade);
+	exec_sink(conf, conf->field, &fade);
+
+	if (fine >= 0) {
+		fade.dither = DITHER_SCALE;
+		if (fade.rate == 0)
+			fade.rate = EXEC_RATE_MAX;
+	}
+
+	if (conf->field == LIGHT_BRIGHTNESS) {
+		followers = follow_new(conf, fd, max, &fade);
+		exec_publish(conf, curr_raw, new_raw, max, fade.usec);
+	}
+
+	if (fine >= 0)
+		written = file_write(fd, curr_raw * DITHER_SCALE, fine, &fade);
+	else
+		written = file_write(fd, curr_raw, new_raw, &fade);
+	written = exec_sink_sync(conf, conf->field) && written;
+	follow_free(followers);
+
+	if (!written)
+		return false;
+
+	if (conf->field == LIGHT_BRIGHTNESS) {
+		exec_publish(conf, new_raw, new_raw, max, 0);
+		usage_log(conf, curr_raw, new_raw, max, fade.usec);
+	}
+
+	if (fade.usec > 0)
+		vlog_notice("fade on %s power: %" PRId64 " wakeups", power_name(power),
+			    fade.wakeups);
+
+	/* opportunistically refine the estimate, failing is harmless; through
+	 * logind it would be the latency of the bus, not of the device */
+	if (conf->field == LIGHT_BRIGHTNESS && fade.put != logind_put)
+		exec_latency_save(conf, fade.latency, false);
+
+	return fine >= 0 ? exec_dither(conf, fd, fine, fade.latency) : true;
+}
+
+/**
+ * exec_lock:
+ * @fd:		opened delta mailbox
+ * @at:		byte to lock or unlock
+ * @cmd:	lockf() command
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_lock(int fd, off_t at, int cmd)
+{
+	return lseek(fd, at, SEEK_SET) == at && lockf(fd, cmd, 1) == 0;
+}
+
+/**
+ * exec_mailbox:
+ *
+ * Steps posted for a controller, summed by value mode, with counts
+ * of the steps posted, taken out and handled, so the next process
+ * applying steps sees what the last one left unfinished.
+ **/
+struct exec_mailbox {
+	int64_t pending[EXEC_DELTA_MODES];
+	int64_t stamp_ns;	/* CLOCK_REALTIME of the last post, kept across boots */
+	int64_t posted;		/* steps posted */
+	int64_t taken;		/* steps taken out to be applied */
+	int64_t done;		/* steps applied or lost */
+};
 
 /**
- * exec_get_max:
+ * exec_delta_open:
+ * @fd:		opened delta mailbox
+ * @box:	where to store its contents
  *
- * Determines max value from cache, or by fetching it.
+ * Locks the mailbox and reads it.
  *
- * Returns: negative value on failure, raw max value on success
+ * Returns: true on success, false on failure
  **/
-static int64_t exec_get_max(struct light_conf *conf)
+static bool exec_delta_open(int fd, struct exec_mailbox *box)
 {
-	if (conf->cached_max != 0)
-		return conf->cached_max;
-	return light_fetch(conf, LIGHT_MAX_BRIGHTNESS);
+	ssize_t r;
+
+	if (!exec_lock(fd, EXEC_DELTA_LOCK, F_LOCK))
+		return false;
+
+	/* a new mailbox is empty */
+	memset(box, 0, sizeof(*box));
+	if ((r = pread(fd, box, sizeof(*box), 0)) < 0) {
+		exec_lock(fd, EXEC_DELTA_LOCK, F_ULOCK);
+		return false;
+	}
+	if ((size_t) r < sizeof(*box))
+		memset(box, 0, sizeof(*box));
+
+	return true;
 }
 
 /**
- * exec_open:
- * @conf:	configuration object
- * @field:	field to access
- * @flags:	flags to pass to open
- *
- * Opens a given field with the flags specified.
+ * exec_delta_close:
+ * @fd:		delta mailbox locked by exec_delta_open()
+ * @box:	contents to store
  *
- * Returns: an fd on success, negative value on failure
+ * Returns: true on success, false on failure
  **/
-static int exec_open(struct light_conf *conf, LIGHT_FIELD field, int flags)
+static bool exec_delta_close(int fd, const struct exec_mailbox *box)
 {
-	burn_o char *path = light_path_new(conf, field);
-	return path ? file_open(path, flags) : -1;
+	bool ok = pwrite(fd, box, sizeof(*box), 0) == (ssize_t) sizeof(*box);
+
+	exec_lock(fd, EXEC_DELTA_LOCK, F_ULOCK);
+	return ok;
 }
 
 /**
- * exec_get:
- * @conf:	configuration object
- * @max:	maximum raw value
+ * exec_delta_post:
+ * @fd:		opened delta mailbox
+ * @step:	step to add
+ * @mode:	value mode of the step
  *
- * Executes the get operation, printing the appropriate field to standard out.
+ * Posts a step. Steps nobody took for EXEC_DELTA_EXPIRE_NSEC while
+ * no process was applying steps are dropped first, such as those
+ * left behind by a process killed on the way, so they never land
+ * much later.
  *
  * Returns: true on success, false on failure
  **/
-static bool exec_get(struct light_conf *conf)
+static bool exec_delta_post(int fd, int64_t step, LIGHT_VAL_MODE mode)
 {
-	int64_t raw_val, val, max;
+	struct exec_mailbox box;
+	struct timespec t;
+	int64_t now;
 
-	if ((max = exec_get_max(conf)) < 0)
+	if (!exec_delta_open(fd, &box))
 		return false;
 
-	switch (conf->field) {
-	case LIGHT_BRIGHTNESS:
-		raw_val = light_fetch(conf, LIGHT_BRIGHTNESS);
-		break;
-	case LIGHT_MAX_BRIGHTNESS:
-		raw_val = max;
-		break;
-	case LIGHT_MIN_CAP:
-		raw_val = exec_get_min(conf);
-		break;
-	case LIGHT_SAVERESTORE:
-		return true;
-	default:
+	clock_gettime(CLOCK_REALTIME, &t);
+	now = (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+
+	if (box.posted > box.taken && exec_lock(fd, EXEC_DELTA_OWNER, F_TEST) &&
+	    (now - box.stamp_ns > EXEC_DELTA_EXPIRE_NSEC || box.stamp_ns > now)) {
+		vlog_info("dropping steps posted too long ago");
+		memset(box.pending, 0, sizeof(box.pending));
+		box.taken = box.done = box.posted;
+	}
+
+	box.pending[mode] += step;
+	box.stamp_ns = now;
+	box.posted++;
+
+	return exec_delta_close(fd, &box);
+}
+
+/**
+ * exec_delta_apply:
+ * @conf:	configuration object to operate on
+ * @fd:		delta mailbox whose owner lock is held
+ *
+ * Takes the pending steps out and applies their sum. Steps the
+ * previous owner took and did not finish, as it failed or was
+ * killed, are lost rather than applied late.
+ *
+ * Returns: true on success, false if steps were lost
+ **/
+static bool exec_delta_apply(struct light_conf *conf, int fd)
+{
+	struct exec_mailbox box;
+	int64_t take[EXEC_DELTA_MODES];
+	bool ret = true;
+
+	if (!exec_delta_open(fd, &box))
 		return false;
+
+	if (box.taken > box.done) {
+		vlog_err("%" PRId64 " steps of '%s' were lost with the process applying them",
+			 box.taken - box.done, conf->ctrl);
+		box.done = box.taken;
+		ret = false;
 	}
 
-	if (raw_val < 0)
+	memcpy(take, box.pending, sizeof(take));
+	memset(box.pending, 0, sizeof(box.pending));
+	box.taken = box.posted;
+	if (!exec_delta_close(fd, &box))
 		return false;
 
-	val = value_from_raw(conf->val_mode, raw_val, max);
+	for (int m = 0; m < EXEC_DELTA_MODES; m++) {
+		if (take[m] == 0)
+			continue;
 
-	if (conf->val_mode == LIGHT_RAW)
-		printf("%" PRId64 "\n", val);
-	else
-		printf("%.2f\n", ((double) val / 100.00));
+		conf->val_mode = (LIGHT_VAL_MODE) m;
+		conf->op_mode = take[m] < 0 ? LIGHT_SUB : LIGHT_ADD;
+		conf->value = take[m] < 0 ? -take[m] : take[m];
+		if (!exec_set(conf)) {
+			vlog_err("steps of '%s' were lost", conf->ctrl);
+			ret = false;
+			break;
+		}
+	}
 
-	return true;
+	/* failed or not, they are handled */
+	if (exec_delta_open(fd, &box)) {
+		box.done = box.taken;
+		exec_delta_close(fd, &box);
+	}
+
+	return ret;
 }
 
 /**
- * exec_set:
+ * exec_step:
  * @conf:	configuration object to operate on
  *
- * Sets the minimum cap or brightness value.
+ * Steps the brightness up or down. Steps of concurrent processes,
+ * such as those of a held brightness key, are posted to a mailbox
+ * in the cache. Whichever process gets to apply them applies their
+ * sum in one write, and the others return at once. After letting
+ * go, it looks again, since a step posted meanwhile was left to it.
  *
  * Returns: true on success, false on failure
  **/
-static bool exec_set(struct light_conf *conf)
+static bool exec_step(struct light_conf *conf)
 {
-	int64_t new_value, curr_value, new_raw, max, curr_raw = -1, mincap = 0;
-	burn_fd fd = exec_open(conf, conf->field, O_WRONLY);
+	struct exec_mailbox box;
+	struct light_conf saved = *conf;
+	bool ret = true, more = true;
+	burn_path path = init_cache(conf, true) ? light_path_new(conf, LIGHT_DELTA) : NULL;
+	burn_fd fd = path ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
 
-	if (fd < 0)
-		return false;
+	if (fd < 0 || !exec_delta_post(fd, conf->op_mode == LIGHT_SUB ? -conf->value : conf->value,
+				       conf->val_mode)) {
+		vlog_info("no step mailbox for '%s', stepping alone", conf->ctrl);
+		return exec_set(conf);
+	}
 
-	if (conf->field == LIGHT_MIN_CAP)
-		curr_raw = exec_get_min(conf);
-	else
-		mincap = exec_get_min(conf);
+	while (more && exec_lock(fd, EXEC_DELTA_OWNER, F_TLOCK)) {
+		ret = exec_delta_apply(conf, fd) && ret;
+		exec_lock(fd, EXEC_DELTA_OWNER, F_ULOCK);
 
-	if (conf->field != LIGHT_MIN_CAP)
-		curr_raw = light_fetch(conf, conf->field);
+		more = false;
+		if (exec_delta_open(fd, &box)) {
+			more = box.posted > box.taken;
+			exec_lock(fd, EXEC_DELTA_LOCK, F_ULOCK);
+		}
+	}
 
-	if (curr_raw < 0)
+	if (more)
+		vlog_info("steps of '%s' are applied by another process", conf->ctrl);
+
+	conf->val_mode = saved.val_mode;
+	conf->op_mode = saved.op_mode;
+	conf->value = saved.value;
+
+	return ret;
+}
+
+/**
+ * exec_set_color:
+ * @conf:	configuration object to operate on
+ *
+ * Sets, increments or decrements the color components of a multicolor
+ * LED. A single given component applies to all of them, and none goes
+ * above the thermal cap. The brightness is left alone, so every frame
+ * of a fade is a single write of multi_intensity.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_set_color(struct light_conf *conf)
+{
+	int64_t curr[LIGHT_COLORS_MAX], next[LIGHT_COLORS_MAX], max, maxcap;
+	struct file_fade fade;
+	burn_fd fd = -1;
+	int n;
+
+	if ((n = exec_fetch_color(conf, curr)) < 0)
 		return false;
 
 	if ((max = exec_get_max(conf)) < 0)
 		return false;
 
-	new_value = conf->value;
-	curr_value = value_from_raw(conf->val_mode, curr_raw, max);
-	vlog_notice("specified value: %" PRId64, new_value);
-	vlog_notice("current value: %" PRId64, curr_value);
+	if (conf->colors != 1 && conf->colors != n) {
+		vlog_err("'%s' has %d color components, got %d", conf->ctrl, n, conf->colors);
+		return false;
+	}
+
+	/* the thermal cap bounds every component, but a color turned off
+	 * stays off, so the minimum cap only bounds the cap itself */
+	maxcap = exec_get_cap(conf, exec_get_min(conf), max);
+
+	for (int k = 0; k < n; k++) {
+		int64_t val = conf->color[conf->colors == 1 ? 0 : k];
+		int64_t cur = value_from_raw(conf->val_mode, curr[k], max);
 
-	if (conf->field == LIGHT_BRIGHTNESS) {
 		switch (conf->op_mode) {
-		case LIGHT_SUB:
-			/* val is unsigned so we need to get back to >= 0 */
-			if (new_value > curr_value)
-				new_value = -curr_value;
-			else
-				new_value = -new_value;
-			/* FALLTHRU */
+		case LIGHT_SET:
+			break;
 		case LIGHT_ADD:
-			new_value += curr_value;
+			val += cur;
 			break;
-		case LIGHT_SET:
+		case LIGHT_SUB:
+			val = val > cur ? 0 : cur - val;
 			break;
 		default:
 			return false;
 		}
-	} else if (conf->field != LIGHT_MIN_CAP) {
+
+		next[k] = value_clamp(value_to_raw(conf->val_mode, val, max), 0, maxcap);
+	}
+
+	if (memcmp(curr, next, n * sizeof(*curr)) == 0)
+		return exec_skip(conf, curr[0]);
+
+	if ((fd = exec_open(conf, LIGHT_MULTI_INTENSITY, O_WRONLY)) < 0)
+		return false;
+
+	exec_fade_init(conf, &fade);
+	return file_write_vec(fd, curr, next, n, &fade);
+}
+
+/**
+ * exec_animate:
+ * @conf:	configuration object to operate on
+ *
+ * Plays the keyframes in conf->file on the brightness. A closed loop
+ * on an LED with a pattern trigger is handed to the kernel, anything
+ * else is faded from keyframe to keyframe on a single timeline, so
+ * the segments do not drift apart, until the last repeat is done or
+ * the animation is interrupted.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_animate(struct light_conf *conf)
+{
+	struct anim a;
+	struct file_fade fade;
+	struct follow *followers = NULL;
+	int64_t start, from, max, mincap, t0, t;
+	bool played = true;
+	burn_fd fd = -1;
+
+	if (!anim_load(conf, &a))
+		return false;
+
+	mincap = exec_get_min(conf);
+	if ((start = light_fetch(conf, LIGHT_BRIGHTNESS)) < 0 || (max = exec_get_max(conf)) < 0)
+		return false;
+
+	anim_raw(&a, conf->val_mode, start, mincap, exec_get_cap(conf, mincap, max), max);
+
+	if (!dither_release(conf))
+		return false;
+
+	if (anim_pattern(conf, &a, start))
+		return true;
+
+	if ((fd = exec_open(conf, LIGHT_BRIGHTNESS, O_WRONLY)) < 0)
 		return false;
+
+	/* the power policy applies as to a single fade through one run */
+	conf->usec = 0;
+	for (int i = 0; i < a.n; i++)
+		conf->usec += a.key[i].usec;
+
+	exec_fade_init(conf, &fade);
+	exec_sink(conf, LIGHT_BRIGHTNESS, &fade);
+	fade.clock = anim_clock();
+
+	/* a device that is off only gets where the last run ends */
+	if (fade.usec == 0 && conf->usec > 0) {
+		a.key[0] = a.key[a.n - 1];
+		a.key[0].usec = 0;
+		a.key[0].step = false;
+		a.n = 1;
+		a.repeat = 1;
 	}
+	followers = follow_new(conf, fd, max, &fade);
 
-	new_raw = value_to_raw(conf->val_mode, new_value, max);
+	from = start;
+	t0 = t = fade.clock->now(fade.clock->ctx);
 
-	/* Force any increment to result in some change, however small */
-	if (conf->op_mode == LIGHT_ADD && new_raw <= curr_raw)
-		new_raw += 1;
+	for (int64_t r = 0; played && (a.repeat == 0 || r < a.repeat); r++) {
+		for (int i = 0; played && i < a.n; i++) {
+			const struct anim_key *k = &a.key[i];
+			bool hold = k->step || from == k->raw;
+
+			exec_publish(conf, from, k->raw, max, hold ? 0 : k->usec);
+
+			fade.usec = hold ? 0 : k->usec;
+			fade.curve = k->curve;
+			fade.start_ns = t;
+			played = (from == k->raw || file_write(fd, from, k->raw, &fade)) &&
+				 (!hold || fade.clock->sleep(fade.clock->ctx, t + k->usec * 1000));
+
+			t += k->usec * 1000;
+			from = k->raw;
+		}
+	}
+
+	played = exec_sink_sync(conf, LIGHT_BRIGHTNESS) && played;
+	follow_free(followers);
+
+	/* an interrupted fade stopped somewhere between two keyframes */
+	if (anim_stopped())
+		from = light_fetch(conf, LIGHT_BRIGHTNESS);
+	else if (!played)
+		return false;
 
-	new_raw = value_clamp(new_raw, mincap, max);
+	if (from >= 0) {
+		exec_publish(conf, from, from, max, 0);
+		usage_log(conf, start, from, max, (fade.clock->now(fade.clock->ctx) - t0) / 1000);
+	}
 
-	return file_write(fd, curr_raw, new_raw, conf->usec);
+	return true;
 }
 
 /**
@@ -165,31 +1092,59 @@ static bool exec_set(struct light_conf *conf)
  * @conf:	configuration object to operate on
  *
  * Iterates through available controllers and executes
- * the requested operation for each one.
+ * the requested operation for each one. Writes go to the
+ * preferred controller of each output only, unless the
+ * ctrl.group configuration key is 0.
  *
  * Returns: true on success, false on failure
  **/
 bool exec_all(struct light_conf *conf)
 {
-	bool ret = true;
-	burn_dir dir = opendir(conf->sys_prefix);
+	struct ctrl_groups groups;
+	bool ret = true, grouped;
+	int ctrls = 0, skipped = exec_skipped;
+	burn_dir dir = init_sys(conf) ? opendir(conf->sys_prefix) : NULL;
+	burn_dir dev = NULL;
 
 	if (!dir) {
 		vlog_err("opendir: %m");
 		return false;
 	}
 
+	dev = ctrl_ddc_dir(conf);
+
+	grouped = (conf->op_mode == LIGHT_SET || conf->op_mode == LIGHT_ADD ||
+		   conf->op_mode == LIGHT_SUB || conf->op_mode == LIGHT_RESTORE) &&
+		  conf->field == LIGHT_BRIGHTNESS && cfg_int("ctrl.group", 1) != 0 &&
+		  ctrl_groups(conf, &groups);
+
 	/* Change the controller mode so exec_op() does its thing */
 	conf->ctrl_mode = LIGHT_CTRL_SPECIFY;
 
-	while ((conf->ctrl = ctrl_iter_next(dir))) {
-		if (conf->op_mode == LIGHT_GET)
+	/* sysfs controllers first, then DDC/CI displays */
+	while ((conf->ctrl = ctrl_iter_next(dir)) || (conf->ctrl = ctrl_ddc_next(conf, dev, true))) {
+		const char *lead = grouped ? ctrl_lead(&groups, conf->ctrl) : NULL;
+
+		if (lead) {
+			vlog_info("'%s' drives the same output as '%s', leaving it alone",
+				  conf->ctrl, lead);
+			path_free(conf->ctrl);
+			continue;
+		}
+
+		conf->cached_max = 0;
+		if (conf->op_mode == LIGHT_GET || conf->op_mode == LIGHT_CALIBRATE)
 			fprintf(stdout, "%s\t", conf->ctrl);
 		if (!exec_op(conf))
 			ret = false;
-		free(conf->ctrl);
+		path_free(conf->ctrl);
+		ctrls++;
 	}
 
+	if (exec_skipped > skipped)
+		vlog_notice("%d of %d controllers already held the value", exec_skipped - skipped,
+			    ctrls);
+
 	return ret;
 }
 
@@ -204,9 +1159,81 @@ static bool exec_save(struct light_conf *conf)
 	int64_t curr = light_fetch(conf, LIGHT_BRIGHTNESS);
 	if (curr < 0)
 		return false;
+	if (light_fetch(conf, LIGHT_SAVERESTORE) == curr)
+		return exec_skip(conf, curr);
 	return exec_write(conf, LIGHT_SAVERESTORE, curr, curr);
 }
 
+/**
+ * exec_calibrate:
+ * @conf:	configuration object
+ *
+ * Measures the write latency of the controller by writing its
+ * current value back a few times, then prints the mean latency
+ * in microseconds and replaces the cached estimate with it, unless
+ * it was written through logind.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_calibrate(struct light_conf *conf)
+{
+	int64_t total = 0, curr = light_fetch(conf, LIGHT_BRIGHTNESS);
+	burn_fd fd = exec_open(conf, LIGHT_BRIGHTNESS, O_WRONLY);
+	bool bus = false;
+
+	if (fd < 0 || curr < 0)
+		return false;
+
+	for (int i = 0; i < EXEC_CALIBRATE_WRITES; i++) {
+		struct file_fade fade = { 0 };
+		exec_sink(conf, LIGHT_BRIGHTNESS, &fade);
+		if (!file_write(fd, curr, curr, &fade) || !exec_sink_sync(conf, LIGHT_BRIGHTNESS))
+			return false;
+		total += fade.latency;
+		bus = fade.put == logind_put;
+	}
+
+	total /= EXEC_CALIBRATE_WRITES;
+	printf("%" PRId64 "\n", total);
+
+	if (bus) {
+		vlog_notice("measured through logind, keeping the cached estimate");
+		return true;
+	}
+
+	return exec_latency_save(conf, total, true);
+}
+
+/**
+ * exec_daemon:
+ * @conf:	configuration object to operate on
+ *
+ * Runs a long-running mode, logging to syslog instead of
+ * stderr if the log configuration key says so.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool exec_daemon(struct light_conf *conf)
+{
+	const char *log = cfg_get("log");
+
+	if (log && strcmp(log, "syslog") == 0)
+		vlog_syslog(PROG);
+
+	switch (conf->op_mode) {
+	case LIGHT_AMBIENT:
+		return als_run(conf);
+	case LIGHT_SCHEDULE:
+		return sched_run(conf);
+	case LIGHT_INPUT:
+		return input_run(conf);
+	case LIGHT_THERMAL:
+		return thermal_run(conf);
+	default:
+		return false;
+	}
+}
+
 /**
  * exec_op:
  * @conf:	configuration object to operate on
@@ -217,12 +1244,28 @@ static bool exec_save(struct light_conf *conf)
  **/
 bool exec_op(struct light_conf *conf)
 {
-	if (info_print(conf->op_mode, conf->sys_prefix, false))
-		return info_print(conf->op_mode, conf->sys_prefix, true);
+	if (info_print(conf->op_mode, NULL, false))
+		return (conf->op_mode != LIGHT_LIST_CTRL || init_sys(conf)) &&
+		       info_print(conf->op_mode, conf, true);
+
+	/* long-running modes drive every controller themselves */
+	if (conf->op_mode == LIGHT_AMBIENT || conf->op_mode == LIGHT_SCHEDULE ||
+	    conf->op_mode == LIGHT_INPUT || conf->op_mode == LIGHT_THERMAL)
+		return exec_daemon(conf);
+
+	/* the report covers every controller that was logged */
+	if (conf->op_mode == LIGHT_REPORT)
+		return usage_report(conf);
 
 	if (conf->ctrl_mode == LIGHT_CTRL_ALL)
 		return exec_all(conf);
 
+	if (conf->op_mode == LIGHT_GET && exec_get_fast(conf))
+		return true;
+
+	if (!init_ctrl(conf))
+		return false;
+
 	vlog_notice("executing light on '%s' controller", conf->ctrl);
 
 	switch (conf->op_mode) {
@@ -232,10 +1275,20 @@ bool exec_op(struct light_conf *conf)
 		return exec_get(conf);
 	case LIGHT_RESTORE:
 		return exec_restore(conf);
+	case LIGHT_CALIBRATE:
+		return exec_calibrate(conf);
 	case LIGHT_SET:
 	case LIGHT_SUB:
 	case LIGHT_ADD:
+		if (conf->defer)
+			exec_defer(conf);
+		if (conf->field == LIGHT_MULTI_INTENSITY)
+			return exec_set_color(conf);
+		if (conf->op_mode != LIGHT_SET && conf->field == LIGHT_BRIGHTNESS && !conf->dither)
+			return exec_step(conf);
 		return exec_set(conf);
+	case LIGHT_ANIMATE:
+		return exec_animate(conf);
 	default:
 		/* Should not be reached */
 		fprintf(stderr,
@@ -248,6 +1301,41 @@ bool exec_op(struct light_conf *conf)
 	}
 }
 
+/**
+ * exec_apply:
+ * @conf:	configuration object to operate on
+ * @op:		operation to run
+ * @val_mode:	mode the value is given in
+ * @value:	value to apply
+ * @usec:	time used to smooth the operation
+ *
+ * Runs a one-off operation on behalf of a long-running mode,
+ * leaving the configuration of that mode as it was.
+ *
+ * Returns: true on success, false on failure
+ **/
+bool exec_apply(struct light_conf *conf, LIGHT_OP_MODE op,
+		LIGHT_VAL_MODE val_mode, int64_t value, int64_t usec)
+{
+	struct light_conf saved = *conf;
+	bool r;
+
+	conf->op_mode = op;
+	conf->val_mode = val_mode;
+	conf->value = value;
+	conf->usec = usec;
+
+	r = exec_op(conf);
+
+	conf->op_mode = saved.op_mode;
+	conf->val_mode = saved.val_mode;
+	conf->value = saved.value;
+	conf->usec = saved.usec;
+	conf->ctrl_mode = saved.ctrl_mode;
+
+	return r;
+}
+
 /**
  * light_path_new:
  * @conf:	configuration object to generate path from
@@ -257,7 +1345,7 @@ bool exec_op(struct light_conf *conf)
  * stores it in the string pointed to by buffer.
  *
  * WARNING: this function allocates memory, but does not free it.
- *          free the data pointed to by the return value after use.
+ *          free the data pointed to by the return value with path_free().
  *
  * Returns: the generated path, or NULL on failure
  **/
@@ -266,16 +1354,23 @@ char *light_path_new(struct light_conf *conf, LIGHT_FIELD type)
 	char *p;
 	const char *fmt, *prefix;
 
-	if (!path_component(conf->ctrl))
+	if (!init_ctrl(conf) || !path_component(conf->ctrl))
 		return NULL;
 
-	if (type == LIGHT_BRIGHTNESS || type == LIGHT_MAX_BRIGHTNESS)
-		prefix = conf->sys_prefix;
-	else if (type == LIGHT_MIN_CAP || type == LIGHT_SAVERESTORE)
-		prefix = conf->cache_prefix;
+	if (type == LIGHT_BRIGHTNESS || type == LIGHT_MAX_BRIGHTNESS ||
+	    type == LIGHT_MULTI_INTENSITY || type == LIGHT_TRIGGER ||
+	    type == LIGHT_PATTERN || type == LIGHT_REPEAT || type == LIGHT_BL_POWER)
+		prefix = init_sys(conf);
+	else if (exec_cached(type))
+		prefix = init_cache(conf, false);
+	else if (type == LIGHT_MAX_CAP)
+		prefix = init_run(conf, false);
 	else
 		return NULL;
 
+	if (!prefix)
+		return NULL;
+
 	switch (type) {
 	case LIGHT_BRIGHTNESS:
 		fmt = "%s/%s/brightness";
@@ -283,12 +1378,39 @@ char *light_path_new(struct light_conf *conf, LIGHT_FIELD type)
 	case LIGHT_MAX_BRIGHTNESS:
 		fmt = "%s/%s/max_brightness";
 		break;
+	case LIGHT_MULTI_INTENSITY:
+		fmt = "%s/%s/multi_intensity";
+		break;
+	case LIGHT_TRIGGER:
+		fmt = "%s/%s/trigger";
+		break;
+	case LIGHT_PATTERN:
+		fmt = "%s/%s/pattern";
+		break;
+	case LIGHT_REPEAT:
+		fmt = "%s/%s/repeat";
+		break;
+	case LIGHT_BL_POWER:
+		fmt = "%s/%s/bl_power";
+		break;
 	case LIGHT_MIN_CAP:
 		fmt = "%s.%s.mincap";
 		break;
 	case LIGHT_SAVERESTORE:
 		fmt = "%s.%s.brightness";
 		break;
+	case LIGHT_LATENCY:
+		fmt = "%s.%s.latency";
+		break;
+	case LIGHT_DDC:
+		fmt = "%s.%s.ddc";
+		break;
+	case LIGHT_DELTA:
+		fmt = "%s.%s.delta";
+		break;
+	case LIGHT_MAX_CAP:
+		fmt = "%s.%s.maxcap";
+		break;
 	default:
 		return NULL;
 	}
@@ -310,7 +1432,12 @@ char *light_path_new(struct light_conf *conf, LIGHT_FIELD type)
  **/
 int64_t light_fetch(struct light_conf *conf, LIGHT_FIELD field)
 {
-	burn_o char *path = light_path_new(conf, field);
+	burn_path path = NULL;
+
+	if (exec_ddc(conf, field))
+		return ddc_fetch(conf->ctrl, field);
+
+	path = light_path_new(conf, field);
 	return path ? file_read(path) : -ENOMEM;
 }
 
@@ -328,8 +1455,29 @@ int64_t light_fetch(struct light_conf *conf, LIGHT_FIELD field)
 static bool exec_write(struct light_conf *conf, LIGHT_FIELD field,
 		int64_t val_old, int64_t val_new)
 {
+	struct file_fade fade = { 0 };
 	burn_fd fd = exec_open(conf, field, O_WRONLY);
-	return fd > 0 ? file_write(fd, val_old, val_new, conf->usec) : false;
+	return fd > 0 ? file_write(fd, val_old, val_new, &fade) : false;
+}
+
+/**
+ * exec_fetch_color:
+ * @conf:	configuration object to fetch from
+ * @vals:	where to store the color components
+ *
+ * Returns: number of color components on success, -errno on failure
+ **/
+static int exec_fetch_color(struct light_conf *conf, int64_t *vals)
+{
+	burn_path path = light_path_new(conf, LIGHT_MULTI_INTENSITY);
+	int n = path ? file_read_vec(path, vals, LIGHT_COLORS_MAX) : -ENOMEM;
+
+	if (n < 0) {
+		errno = -n;
+		vlog_err("reading multi_intensity of '%s': %m", conf->ctrl);
+	}
+
+	return n;
 }
 
 /**
@@ -341,14 +1489,57 @@ static bool exec_write(struct light_conf *conf, LIGHT_FIELD field,
 static int64_t exec_get_min(struct light_conf *conf)
 {
 	int64_t mincap = light_fetch(conf, LIGHT_MIN_CAP);
-	if (mincap == -ENOENT)
+	/* a cache file the writer has just created is still empty */
+	if (mincap == -ENOENT || mincap == -ENODATA)
 		mincap = 1;
 	if (mincap >= 0)
 		return mincap;
+	errno = (int) -mincap;
 	vlog_err("fetching mincap value: %m");
 	return 0;
 }
 
+/**
+ * exec_get_cap:
+ * @conf:	configuration object to operate on
+ * @mincap:	minimum raw value
+ * @max:	maximum raw value
+ *
+ * Reads the maximum cap that -Z holds the brightness at while the
+ * device runs hot. Every user obeys it, so it is only trusted if it
+ * belongs to root or to the caller, and nobody else may write it.
+ * It never goes below the minimum cap.
+ *
+ * Returns: the maxcap if it is set, otherwise max
+ **/
+static int64_t exec_get_cap(struct light_conf *conf, int64_t mincap, int64_t max)
+{
+	char buf[32];
+	int64_t maxcap = -1;
+	struct stat st;
+	ssize_t len;
+	burn_path path = light_path_new(conf, LIGHT_MAX_CAP);
+	burn_fd fd = path ? open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC) : -1;
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return max;
+
+	if ((st.st_uid != 0 && st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		vlog_warning("ignoring '%s', which others could have written", path);
+		return max;
+	}
+
+	if ((len = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return max;
+	buf[len] = '\0';
+
+	if (sscanf(buf, "%" SCNd64, &maxcap) != 1 || maxcap < 0 || maxcap >= max)
+		return max;
+
+	vlog_info("running hot, capped at %" PRId64, maxcap);
+	return maxcap > mincap ? maxcap : mincap;
+}
+
 /**
  * exec_restore:
  * @conf:	configuration object to operate on
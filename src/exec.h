@@ -8,6 +8,8 @@
 #include "light.h"
 
 bool exec_op(struct light_conf *conf);
+bool exec_apply(struct light_conf *conf, LIGHT_OP_MODE op,
+		LIGHT_VAL_MODE val_mode, int64_t value, int64_t usec);
 char *light_path_new(struct light_conf *conf, LIGHT_FIELD type)
 	__attribute__ ((warn_unused_result));
 int64_t light_fetch(struct light_conf *conf, LIGHT_FIELD field);
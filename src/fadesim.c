@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+/*
+ * Runs the fade engine against a simulated clock, so timing, drift
+ * and step distribution can be checked in milliseconds of real time.
+ * Writes take simulated time, wakeups can come late and the clock
+ * can jump, as it does across a suspend.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vlog.h"
+#include "file.h"
+
+#define SIM_FRAMES_MAX 1024
+#define SIM_MSEC INT64_C(1000000)
+
+/**
+ * sim:
+ *
+ * Simulated CLOCK_MONOTONIC and device. Every write costs write_ns,
+ * write number stall_at costs stall_ns on top, every sleep overshoots
+ * by sched_ns and once now passes jump_at it leaps by jump_ns.
+ **/
+struct sim {
+	int64_t now;
+	int64_t write_ns;
+	int64_t sched_ns;
+	int64_t stall_at;
+	int64_t stall_ns;
+	int64_t jump_at;
+	int64_t jump_ns;
+	int frames;
+	int64_t val[SIM_FRAMES_MAX];
+	int64_t at[SIM_FRAMES_MAX];
+};
+
+/**
+ * sim_case:
+ *
+ * A fade, the conditions it runs under and what it must achieve.
+ **/
+struct sim_case {
+	const char *id;
+	int64_t start;
+	int64_t end;
+	struct file_fade fade;
+	struct sim sim;
+	int frames_min;		/* fewest frames written */
+	int frames_max;		/* most frames written */
+	int64_t late_ms;	/* how late the last frame may come */
+};
+
+static int64_t sim_now(void *ctx)
+{
+	struct sim *s = ctx;
+
+	if (s->jump_ns > 0 && s->now >= s->jump_at) {
+		s->now += s->jump_ns;
+		s->jump_ns = 0;
+	}
+
+	return s->now;
+}
+
+static bool sim_sleep(void *ctx, int64_t until)
+{
+	struct sim *s = ctx;
+
+	if (until > s->now)
+		s->now = until;
+	s->now += s->sched_ns;
+
+	return true;
+}
+
+static bool sim_put(void *ctx, const int64_t *vals, int n)
+{
+	struct sim *s = ctx;
+
+	(void) n;
+
+	if (s->frames == SIM_FRAMES_MAX)
+		return false;
+
+	s->val[s->frames] = vals[0];
+	s->at[s->frames] = s->now;
+
+	s->now += s->write_ns;
+	if (s->frames == s->stall_at)
+		s->now += s->stall_ns;
+	s->frames++;
+
+	return true;
+}
+
+/**
+ * sim_run:
+ * @c:		case to run
+ *
+ * Returns: true if the fade behaved, false otherwise
+ **/
+static bool sim_run(struct sim_case *c)
+{
+	struct sim *s = &c->sim;
+	struct file_clock clock = { .now = sim_now, .sleep = sim_sleep, .ctx = s };
+	int64_t late;
+	bool ok = true;
+
+	c->fade.put = sim_put;
+	c->fade.ctx = s;
+	c->fade.clock = &clock;
+	if (s->stall_ns == 0)
+		s->stall_at = -1;
+
+	if (!file_write(-1, c->start, c->end, &c->fade)) {
+		printf("Fade failed for test: %s\n", c->id);
+		return false;
+	}
+
+	late = (s->at[s->frames - 1] - c->fade.usec * 1000) / SIM_MSEC;
+
+	for (int i = 1; i < s->frames; i++) {
+		if ((c->end - c->start) * (s->val[i] - s->val[i - 1]) < 0 ||
+		    s->at[i] <= s->at[i - 1]) {
+			printf("Frame %d out of order for test: %s\n", i, c->id);
+			ok = false;
+		}
+	}
+
+	if (s->val[s->frames - 1] != c->end) {
+		printf("Ended at %" PRId64 ", expected %" PRId64 " for test: %s\n",
+		       s->val[s->frames - 1], c->end, c->id);
+		ok = false;
+	}
+
+	if (s->frames < c->frames_min || s->frames > c->frames_max) {
+		printf("Wrote %d frames, expected %d to %d for test: %s\n",
+		       s->frames, c->frames_min, c->frames_max, c->id);
+		ok = false;
+	}
+
+	if (late > c->late_ms) {
+		printf("Last frame %" PRId64 " ms late, expected at most %" PRId64
+		       " for test: %s\n", late, c->late_ms, c->id);
+		ok = false;
+	}
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_case cases[] = {
+		{
+			.id = "instant",
+			.start = 0, .end = 1000,
+			.frames_min = 1, .frames_max = 1,
+		},
+		{
+			.id = "ideal",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000 },
+			.frames_min = 51, .frames_max = 51,
+		},
+		{
+			.id = "down",
+			.start = 1000, .end = 3,
+			.fade = { .usec = 700000, .rate = 60 },
+			.frames_min = 43, .frames_max = 43,
+		},
+		{
+			.id = "latency",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000 },
+			.sim = { .write_ns = 5 * SIM_MSEC, .sched_ns = 2 * SIM_MSEC },
+			.frames_min = 51, .frames_max = 51, .late_ms = 2,
+		},
+		{
+			.id = "overload",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000 },
+			.sim = { .write_ns = 45 * SIM_MSEC },
+			.frames_min = 20, .frames_max = 24, .late_ms = 45,
+		},
+		{
+			.id = "jump",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000 },
+			.sim = { .jump_at = 300 * SIM_MSEC, .jump_ns = 5000 * SIM_MSEC },
+			.frames_min = 16, .frames_max = 17, .late_ms = 4320,
+		},
+		{
+			.id = "stall",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000, .timeout = 100000 },
+			.sim = { .stall_at = 10, .stall_ns = 500 * SIM_MSEC },
+			.frames_min = 12, .frames_max = 12, .late_ms = -300,
+		},
+		{
+			.id = "ease",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000, .curve = FILE_CURVE_EASE },
+			.frames_min = 51, .frames_max = 51,
+		},
+		{
+			/* the previous keyframe ran 500 ms over */
+			.id = "behind",
+			.start = 0, .end = 1000,
+			.fade = { .usec = 1000000, .start_ns = 1 },
+			.sim = { .now = 500 * SIM_MSEC },
+			.frames_min = 27, .frames_max = 27,
+		},
+	};
+	struct timespec t0, t1;
+	int ret = EXIT_SUCCESS;
+
+	if (argc < 2 || strcmp(argv[1], "-v") != 0)
+		vlog_lvl_set(VLOG_LVL_ERROR);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (!sim_run(&cases[i]))
+			ret = EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("%zu fades simulated in %.3f ms\n", sizeof(cases) / sizeof(cases[0]),
+	       (double) (t1.tv_sec - t0.tv_sec) * 1e3 + (double) (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+	return ret;
+}
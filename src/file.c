@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: 0BSD */
 
+#define _DEFAULT_SOURCE	/* syscall() */
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -8,6 +10,11 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 
 #include "burno.h"
 #include "vlog.h"
@@ -16,77 +23,106 @@
 #define FILE_MODE_DEFAULT (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 
 #define SMOOTH_WRITES_PER_SECOND 50
-#define SMOOTH_ITER_DURATION 1e9 / SMOOTH_WRITES_PER_SECOND
+#define FILE_READ_MAX 256
+
+/* record of getdents64(), see linux_dirent64 in the kernel */
+struct file_dirent {
+	uint64_t ino;
+	int64_t off;
+	unsigned short reclen;
+	unsigned char type;
+	char name[];
+};
 
 /**
- * file_write_sleep:
- * @nsec:	nanoseconds to sleep for
- * @t0:		initial time spec to compare to
- *
- * Sleeps for nsec nanoseconds, subtracted by how much time
- * has passed since the time stored in t0.
+ * file_clock_now:
+ * @ctx:	unused
  *
- * Returns: true on success, false on failure
+ * Returns: CLOCK_MONOTONIC in nanoseconds, 0 on failure
  **/
-static bool file_write_sleep(long nsec, struct timespec t0)
+static int64_t file_clock_now(void *ctx)
 {
-	struct timespec t_sleep, t1;
+	struct timespec t;
 
-	t_sleep.tv_sec = 0;
-	t_sleep.tv_nsec = nsec;
+	(void) ctx;
 
-	/* get current time so that we can compare to t0 */
-	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t1) < 0) {
+	if (clock_gettime(CLOCK_MONOTONIC, &t) < 0) {
 		vlog_err("clock_gettime: %m");
-		return false;
+		return 0;
 	}
 
-	if ((t1.tv_sec - t0.tv_sec) > 1) {
-		vlog_warning("time diff greater than 1 second, skipping sleep");
-		return true;
-	}
+	return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
 
-	if ((t1.tv_nsec - t0.tv_nsec) < 0)
-		t_sleep.tv_nsec -= (t1.tv_nsec - t0.tv_nsec + 1e9);
-	else
-		t_sleep.tv_nsec -= (t1.tv_nsec - t0.tv_nsec);
+/**
+ * file_clock_sleep:
+ * @ctx:	unused
+ * @until:	CLOCK_MONOTONIC nanoseconds to sleep until
+ *
+ * Sleeping on an absolute deadline keeps slow writes from adding drift.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool file_clock_sleep(void *ctx, int64_t until)
+{
+	struct timespec t_wake = {
+		.tv_sec = (time_t) (until / 1000000000),
+		.tv_nsec = (long) (until % 1000000000),
+	};
+	int r;
 
-	if (t_sleep.tv_nsec <= 0)
-		return true;
+	(void) ctx;
 
-	/* don't overload nanosleep() */
-	if (t_sleep.tv_nsec >= 1e9)
-		t_sleep.tv_nsec = 1e9 - 1;
+	while ((r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t_wake, NULL)) == EINTR)
+		;
 
-	if (nanosleep(&t_sleep, NULL) < 0) {
-		vlog_err("nanosleep: %m");
+	if (r != 0) {
+		errno = r;
+		vlog_err("clock_nanosleep: %m");
 		return false;
 	}
 
 	return true;
 }
 
+static const struct file_clock file_clock_monotonic = {
+	.now = file_clock_now,
+	.sleep = file_clock_sleep,
+};
+
 /**
  * file_rewrite:
  * @fd:		file descriptor to write to
- * @val:	value to write into file
+ * @vals:	values to write into file
+ * @n:		number of values
  *
- * Truncates the file described by fd and prints val into it.
+ * Truncates the file described by fd and prints the values
+ * into it, separated by spaces, with a single write.
  *
  * Returns: true on success, false on failure
  **/
-static bool file_rewrite(int fd, int64_t val)
+bool file_rewrite(int fd, const int64_t *vals, int n)
 {
-	if (val < 0)
-		val = 0;
+	char buf[FILE_VEC_MAX * 21];
+	size_t len = 0;
+
+	for (int i = 0; i < n; i++)
+		len += (size_t) snprintf(buf + len, sizeof(buf) - len, "%s%" PRId64,
+					 i ? " " : "", vals[i] < 0 ? 0 : vals[i]);
 
 	if (ftruncate(fd, 0) < 0) {
 		vlog_err("ftruncate: %m");
 		return false;
 	}
 
-	if (dprintf(fd, "%" PRId64, val) < 0) {
-		vlog_err("dprintf: %" PRId64, val);
+	/* repeated writes to the same fd must not leave a gap */
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		vlog_err("lseek: %m");
+		return false;
+	}
+
+	if (write(fd, buf, len) != (ssize_t) len) {
+		vlog_err("write '%s': %m", buf);
 		return false;
 	}
 
@@ -100,47 +136,256 @@ static bool file_rewrite(int fd, int64_t val)
 }
 
 /**
- * file_write:
+ * file_puts:
  * @fd:		file descriptor to write to
- * @start:	starting value
- * @end:	value to eventually write
- * @usec:	time used to smooth the write
+ * @str:	string to write, such as the name of an LED trigger
  *
- * Writes to the file pointed to by fd, optionally smoothing
- * the operation over usec microseconds.
+ * Returns: true on success, false on failure
+ **/
+bool file_puts(int fd, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (write(fd, str, len) != (ssize_t) len) {
+		vlog_err("write '%s': %m", str);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * file_writer_post:
+ * @w:		writer to hand the frame to
+ * @vals:	freshest values for the device
  *
- * Returns: true on success, false on failure.
+ * Queues vals as the next frame to write. A frame that is
+ * still pending is replaced, so only the latest one wins.
  **/
-bool file_write(int fd, int64_t start, int64_t end, int64_t usec)
+static void file_writer_post(struct file_writer *w, const int64_t *vals)
 {
-	struct timespec t0;
+	if (w->dirty)
+		w->merged++;
+	for (int k = 0; k < w->n; k++)
+		w->pending[k] = vals[k];
+	w->dirty = true;
+}
 
-	vlog_notice("Writing (raw) value: %" PRId64, end);
+/**
+ * file_writer_dither:
+ * @w:		writer holding a frame in 1/w->dither raw steps
+ * @out:	where to store the raw values of the frame
+ *
+ * Rounds the pending frame down to raw levels and carries what was
+ * dropped over to the next frame, so the levels written in a row
+ * average out to the value between them.
+ **/
+static void file_writer_dither(struct file_writer *w, int64_t *out)
+{
+	for (int k = 0; k < w->n; k++) {
+		int64_t fine = (w->pending[k] < 0 ? 0 : w->pending[k]) + w->residue[k];
 
-	int64_t num_writes = usec * SMOOTH_WRITES_PER_SECOND / 1e6;
+		out[k] = fine / w->dither;
+		w->residue[k] = fine - out[k] * w->dither;
+	}
+}
 
-	for (int64_t i = 0; i <= num_writes; i++) {
-		int64_t next_value;
+/**
+ * file_writer_flush:
+ * @w:		writer to flush
+ *
+ * Writes the pending frame, if any, to the device.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool file_writer_flush(struct file_writer *w)
+{
+	int64_t t0, out[FILE_VEC_MAX];
+	const int64_t *vals = w->pending;
+	bool r;
 
-		/* save current time to account for the time
-		 * taken to perform the write operation */
-		clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+	if (!w->dirty)
+		return true;
 
-		if (usec == 0 || i == num_writes)
-			next_value = end;
+	w->dirty = false;
+	w->written++;
+
+	if (w->dither > 1) {
+		file_writer_dither(w, out);
+		vals = out;
+	}
+
+	t0 = w->clock->now(w->clock->ctx);
+	if (w->put)
+		r = w->put(w->ctx, vals, w->n);
+	else
+		r = file_rewrite(w->fd, vals, w->n);
+	w->busy_ns += w->clock->now(w->clock->ctx) - t0;
+
+	return r;
+}
+
+/**
+ * file_frame:
+ * @start:	starting values
+ * @end:	final values
+ * @n:		number of values
+ * @i:		frame index
+ * @num:	number of frames
+ * @curve:	how the values move
+ * @out:	where to store the values of the frame
+ *
+ * Computes frame i of a fade from start to end.
+ **/
+static void file_frame(const int64_t *start, const int64_t *end, int n,
+		       int64_t i, int64_t num, FILE_CURVE curve, int64_t *out)
+{
+	double p = num > 0 ? (double) i / (double) num : 1;
+
+	for (int k = 0; k < n; k++) {
+		if (num == 0 || i >= num)
+			out[k] = end[k];
+		else if (curve == FILE_CURVE_EASE)
+			out[k] = start[k] + (int64_t) ((double) (end[k] - start[k]) * p * p * (3 - 2 * p));
 		else
-			next_value = ((start * num_writes) + ((end - start) * i)) / num_writes;
+			out[k] = ((start[k] * num) + ((end[k] - start[k]) * i)) / num;
+	}
+}
 
-		if (!file_rewrite(fd, next_value))
+/**
+ * file_write_frames:
+ * @w:		writer stage to post frames to
+ * @start:	starting values
+ * @end:	values to eventually write
+ * @fade:	frame rate, timeout and duration used to smooth the write
+ *
+ * Returns: true on success, false on failure.
+ **/
+static bool file_write_frames(struct file_writer *w, const int64_t *start,
+			      const int64_t *end, struct file_fade *fade)
+{
+	const struct file_clock *clk = w->clock;
+	int64_t frame[FILE_VEC_MAX];
+	int64_t rate = fade->rate > 0 ? fade->rate : SMOOTH_WRITES_PER_SECOND;
+	int64_t iter = 1000000000 / rate;
+	int64_t num_writes = fade->usec * rate / 1000000;
+	int64_t t0 = fade->start_ns > 0 ? fade->start_ns : clk->now(clk->ctx);
+
+	for (int64_t i = 0; ; i++) {
+		/* frames whose deadline passed during the last write */
+		int64_t due = (clk->now(clk->ctx) - t0) / iter;
+		int64_t busy = w->busy_ns;
+
+		for (; i < due && i < num_writes; i++) {
+			file_frame(start, end, w->n, i, num_writes, fade->curve, frame);
+			file_writer_post(w, frame);
+		}
+
+		file_frame(start, end, w->n, i, num_writes, fade->curve, frame);
+		file_writer_post(w, frame);
+
+		if (!file_writer_flush(w))
 			return false;
 
-		if (!file_write_sleep(SMOOTH_ITER_DURATION, t0))
+		if (i >= num_writes)
+			break;
+
+		if (fade->timeout > 0 && (w->busy_ns - busy) / 1000 > fade->timeout) {
+			vlog_warning("write stalled for %" PRId64 " usecs, finishing fade",
+				     (w->busy_ns - busy) / 1000);
+			i = num_writes - 1;
+			continue;
+		}
+
+		if (!clk->sleep(clk->ctx, t0 + (i + 1) * iter))
 			return false;
+		fade->wakeups++;
 	}
 
+	vlog_info("wrote %" PRId64 " of %" PRId64 " frames at %" PRId64 " Hz, merged %" PRId64,
+		  w->written, num_writes + 1, rate, w->merged);
+
 	return true;
 }
 
+/**
+ * file_write_vec:
+ * @fd:		file descriptor to write to
+ * @start:	starting values
+ * @end:	values to eventually write
+ * @n:		number of values, at most FILE_VEC_MAX
+ * @fade:	frame rate, timeout and duration used to smooth the write
+ *
+ * Writes to the file pointed to by fd, optionally smoothing
+ * the operation over fade->usec microseconds.
+ *
+ * Frames are generated from a fixed timeline and handed to a
+ * writer stage. The timeline starts at fade->start_ns if set,
+ * so fades played back to back do not drift apart. When a write
+ * blocks past the deadline of later frames, those frames are
+ * merged into the freshest one, so a slow device still reaches
+ * end on time. A write that stalls for longer than fade->timeout
+ * skips straight to the final frame.
+ *
+ * Returns: true on success, false on failure.
+ **/
+bool file_write_vec(int fd, const int64_t *start, const int64_t *end, int n,
+		    struct file_fade *fade)
+{
+	struct file_writer w = {
+		.fd = fd, .n = n, .put = fade->put, .ctx = fade->ctx,
+		.clock = fade->clock ? fade->clock : &file_clock_monotonic,
+		.dither = fade->dither,
+	};
+	int slack = -1;
+	bool r;
+
+	if (n < 1 || n > FILE_VEC_MAX)
+		return false;
+
+	if (fade->dither > 1)
+		vlog_notice("Writing (raw) value: %" PRId64 " + %" PRId64 "/%" PRId64 "%s",
+			    end[0] / fade->dither, end[0] % fade->dither, fade->dither,
+			    n > 1 ? " ..." : "");
+	else
+		vlog_notice("Writing (raw) value: %" PRId64 "%s", end[0], n > 1 ? " ..." : "");
+
+	fade->wakeups = 0;
+
+	/* let the kernel batch our wakeups with others while fading */
+	if (fade->usec > 0 && fade->slack > 0) {
+		slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+		if (prctl(PR_SET_TIMERSLACK, (unsigned long) fade->slack * 1000, 0, 0, 0) < 0)
+			vlog_warning("prctl: %m");
+	}
+
+	r = file_write_frames(&w, start, end, fade);
+
+	if (slack >= 0)
+		prctl(PR_SET_TIMERSLACK, (unsigned long) slack, 0, 0, 0);
+
+	if (w.written > 0)
+		fade->latency = w.busy_ns / w.written / 1000;
+
+	return r;
+}
+
+/**
+ * file_write:
+ * @fd:		file descriptor to write to
+ * @start:	starting value
+ * @end:	value to eventually write
+ * @fade:	frame rate, timeout and duration used to smooth the write
+ *
+ * Writes a single value, see file_write_vec().
+ *
+ * Returns: true on success, false on failure.
+ **/
+bool file_write(int fd, int64_t start, int64_t end, struct file_fade *fade)
+{
+	return file_write_vec(fd, &start, &end, 1, fade);
+}
+
 /**
  * file_open:
  * @path:	path to open
@@ -154,7 +399,7 @@ int file_open(const char *const path, int mode)
 {
 	int fd;
 
-	if ((fd = open(path, mode | O_TRUNC | O_CREAT | O_SYNC, FILE_MODE_DEFAULT)) < 0) {
+	if ((fd = open(path, mode | O_CREAT | O_SYNC, FILE_MODE_DEFAULT)) < 0) {
 		vlog_err("open '%s': %m", path);
 		return -1;
 	}
@@ -172,26 +417,126 @@ int file_open(const char *const path, int mode)
  * file_read:
  * @path:	path to read value from
  *
- * Returns: value, or -errno on error
+ * Returns: value, -ENODATA if the file is empty, or -errno on error
  */
 int64_t file_read(const char *const path)
 {
+	char buf[FILE_READ_MAX];
 	int64_t value;
+	int r = file_read_str(path, buf, sizeof(buf));
+
+	if (r <= 0)
+		return r < 0 ? r : -ENODATA;
+
+	if (sscanf(buf, "%" SCNd64, &value) != 1)
+		return -EINVAL;
+
+	return value;
+}
+
+/**
+ * file_read_vec:
+ * @path:	path to read values from
+ * @vals:	where to store the values
+ * @max:	maximum number of values to read
+ *
+ * Reads space separated values, such as multi_intensity.
+ *
+ * Returns: number of values read, or -errno on error
+ */
+int file_read_vec(const char *const path, int64_t *vals, int max)
+{
+	char buf[FILE_READ_MAX], *s = buf;
+	int n = 0, len, r = file_read_str(path, buf, sizeof(buf));
 
-	burn_file file = fopen(path, "r");
+	if (r < 0)
+		return r;
 
-	if (!file)
+	while (n < max && sscanf(s, "%" SCNd64 "%n", &vals[n], &len) == 1) {
+		s += len;
+		n++;
+	}
+
+	return n > 0 ? n : -EINVAL;
+}
+
+/**
+ * file_read_str:
+ * @path:	path to read from
+ * @buf:	where to store the contents
+ * @size:	size of buf
+ *
+ * Reads a short file, such as the trigger list of an LED, into buf
+ * and terminates it.
+ *
+ * Returns: number of bytes read, or -errno on error
+ */
+int file_read_str(const char *const path, char *buf, size_t size)
+{
+	ssize_t n;
+	burn_fd fd = open(path, O_RDONLY);
+
+	if (fd < 0)
 		return -errno;
 
-	errno = 0;
-	if (fscanf(file, "%" SCNd64, &value) != 1) {
-		if (errno == 0)
-			/* cppcheck-suppress resourceLeak */
-			return -EINVAL;
-		/* cppcheck-suppress resourceLeak */
+	if ((n = read(fd, buf, size - 1)) < 0)
 		return -errno;
-	}
 
-	/* cppcheck-suppress resourceLeak */
-	return value;
+	buf[n] = '\0';
+	return (int) n;
+}
+
+/**
+ * file_read_attr:
+ * @dir:	device directory
+ * @attr:	attribute below dir
+ * @buf:	where to store the contents
+ * @size:	size of buf
+ *
+ * Reads a sysfs attribute as a string, without the trailing newline.
+ *
+ * Returns: true on success, false on failure
+ */
+bool file_read_attr(const char *dir, const char *attr, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int) sizeof(path) ||
+	    file_read_str(path, buf, size) < 0)
+		return false;
+
+	buf[strcspn(buf, "\n")] = '\0';
+	return true;
+}
+
+/**
+ * file_dir_next:
+ * @dir:	directory, with fd opened with O_DIRECTORY and the rest zeroed
+ *
+ * Reads the next entry of a directory, skipping the hidden ones
+ * and "." and "..", without allocating.
+ *
+ * Returns: name of the entry, valid until the next call, or NULL
+ *	    at the end of the directory or on failure
+ */
+const char *file_dir_next(struct file_dir *dir)
+{
+	for (;;) {
+		struct file_dirent *e;
+
+		if (dir->pos >= dir->len) {
+			dir->pos = 0;
+			dir->len = syscall(SYS_getdents64, dir->fd, dir->buf, sizeof(dir->buf));
+			if (dir->len <= 0) {
+				if (dir->len < 0)
+					vlog_debug("getdents64: %m");
+				return NULL;
+			}
+		}
+
+		e = (struct file_dirent *) (dir->buf + dir->pos);
+		dir->pos += e->reclen;
+		if (e->name[0] != '.')
+			return e->name;
+	}
 }
@@ -6,9 +6,101 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-bool file_write(int fd, int64_t start, int64_t end, int64_t usec);
+#define FILE_VEC_MAX 8
+#define FILE_DIR_BUF 2048
+
+typedef enum FILE_CURVE {
+	FILE_CURVE_LINEAR = 0,
+	FILE_CURVE_EASE		/* slow at both ends, a smoothstep */
+} FILE_CURVE;
+
+/**
+ * file_clock:
+ *
+ * Time source of a fade. now() returns monotonic nanoseconds and
+ * sleep() waits until a deadline on that timeline. A fade without
+ * one uses CLOCK_MONOTONIC, a simulated one lets fades be tested
+ * without sleeping.
+ **/
+struct file_clock {
+	int64_t (*now)(void *ctx);
+	bool (*sleep)(void *ctx, int64_t until);
+	void *ctx;
+};
+
+/**
+ * file_writer:
+ *
+ * Writer stage of a fade. Frames are posted into a single
+ * pending slot and written in one go, so values that became
+ * stale while the device was busy are merged, not queued.
+ * A frame is a vector of n values, written with a single write.
+ * With dither set, frames are in 1/dither raw steps and rounded
+ * to raw levels with error diffusion.
+ **/
+struct file_writer {
+	int fd;
+	int n;
+	bool dirty;
+	int64_t pending[FILE_VEC_MAX];
+	int64_t written;
+	int64_t merged;
+	int64_t busy_ns;
+	bool (*put)(void *ctx, const int64_t *vals, int n);
+	void *ctx;
+	const struct file_clock *clock;
+	int64_t dither;
+	int64_t residue[FILE_VEC_MAX];
+};
+
+/**
+ * file_fade:
+ *
+ * Parameters of a (possibly smoothed) write. The caller picks the
+ * frame rate, stall timeout and timer slack, file_write() reports
+ * back the mean latency of the writes it made and how often it woke.
+ **/
+struct file_fade {
+	int64_t usec;		/* duration of the fade */
+	int64_t rate;		/* frames per second, 0 for the default */
+	int64_t timeout;	/* usecs a write may stall before the fade is cut short, 0 for none */
+	int64_t slack;		/* timer slack in usecs while fading, 0 to keep the current one */
+	int64_t latency;	/* set to the mean write latency in usecs */
+	int64_t wakeups;	/* set to the number of sleeps between frames */
+	bool (*put)(void *ctx, const int64_t *vals, int n);	/* writes a frame instead of fd, if set */
+	void *ctx;		/* handed to put */
+	const struct file_clock *clock;	/* time source, NULL for CLOCK_MONOTONIC */
+	int64_t dither;		/* start and end are in 1/dither raw steps, 0 for whole steps */
+	FILE_CURVE curve;	/* how the values move from start to end */
+	int64_t start_ns;	/* time on the clock the fade starts at, 0 for now */
+};
+
+/**
+ * file_dir:
+ *
+ * A directory read in place with getdents64(), unlike readdir()
+ * without the DIR libc allocates. fd is owned by the caller.
+ **/
+struct file_dir {
+	int fd;
+	long pos;
+	long len;
+	char buf[FILE_DIR_BUF] __attribute__ ((aligned(8)));
+};
+
+bool file_rewrite(int fd, const int64_t *vals, int n);
+bool file_puts(int fd, const char *str);
+bool file_write(int fd, int64_t start, int64_t end, struct file_fade *fade);
+bool file_write_vec(int fd, const int64_t *start, const int64_t *end, int n,
+		    struct file_fade *fade);
 int file_open(char const *path, int mode);
 int64_t file_read(char const *path);
+int file_read_vec(char const *path, int64_t *vals, int max);
+int file_read_str(char const *path, char *buf, size_t size);
+bool file_read_attr(const char *dir, const char *attr, char *buf, size_t size);
+const char *file_dir_next(struct file_dir *dir);
 
 #endif /* FILE_H */
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <math.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "cfg.h"
+#include "light.h"
+#include "file.h"
+#include "exec.h"
+#include "follow.h"
+
+#define FOLLOW_MAX 4
+#define FOLLOW_PREFIX "follow."
+
+/**
+ * follower:
+ *
+ * A controller following the leader. Below low percent of the
+ * leader it is off, from high percent on it is at its maximum,
+ * and in between it follows the leader along a power curve.
+ **/
+struct follower {
+	struct light_conf *conf;
+	int fd;
+	int64_t max;
+	int64_t last;
+	double low;
+	double high;
+	double gamma;
+};
+
+/**
+ * follow:
+ *
+ * The followers of a leader for the duration of one write, and
+ * the frame writer of the leader they were chained behind.
+ **/
+struct follow {
+	int fd;
+	int64_t max;
+	bool (*put)(void *ctx, const int64_t *vals, int n);
+	void *ctx;
+	int n;
+	struct follower follower[FOLLOW_MAX];
+};
+
+/**
+ * follow_target:
+ * @key:	"<target>/<controller>"
+ * @target:	where to store the target
+ *
+ * Returns: the controller part of key, or NULL if key is invalid
+ **/
+static const char *follow_target(const char *key, LIGHT_TARGET *target)
+{
+	const char *ctrl;
+
+	if (strncmp(key, "backlight/", strlen("backlight/")) == 0)
+		*target = LIGHT_BACKLIGHT;
+	else if (strncmp(key, "leds/", strlen("leds/")) == 0)
+		*target = LIGHT_KEYBOARD;
+	else
+		return NULL;
+
+	ctrl = strchr(key, '/') + 1;
+	return path_component(ctrl) ? ctrl : NULL;
+}
+
+/**
+ * follow_open:
+ * @f:		follower to set up
+ * @key:	"<target>/<controller>" of the follower
+ *
+ * Opens the follower and reads its maximum and current value,
+ * once for the whole write.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool follow_open(struct follower *f, const char *key)
+{
+	LIGHT_TARGET target;
+	const char *ctrl = follow_target(key, &target);
+	burn_path path = NULL;
+
+	if (!ctrl || !(f->conf = light_new()))
+		return false;
+
+	f->conf->target = target;
+	f->conf->ctrl_mode = LIGHT_CTRL_SPECIFY;
+	f->fd = -1;
+
+	if (!(f->conf->ctrl = strdup(ctrl)) ||
+	    !(path = light_path_new(f->conf, LIGHT_BRIGHTNESS)) ||
+	    (f->max = light_fetch(f->conf, LIGHT_MAX_BRIGHTNESS)) <= 0 ||
+	    (f->last = light_fetch(f->conf, LIGHT_BRIGHTNESS)) < 0 ||
+	    (f->fd = file_open(path, O_WRONLY)) < 0) {
+		light_free(&f->conf);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * follow_raw:
+ * @f:		follower
+ * @raw:	raw value of the leader
+ * @max:	raw maximum of the leader
+ *
+ * Returns: the raw value of the follower for raw
+ **/
+static int64_t follow_raw(const struct follower *f, int64_t raw, int64_t max)
+{
+	double pct = 100.0 * (double) raw / (double) max;
+	double x = (pct - f->low) / (f->high - f->low);
+	int64_t val;
+
+	if (pct < f->low)
+		return 0;
+	if (x >= 1.0)
+		return f->max;
+
+	/* on at all means visibly on */
+	val = (int64_t) lround(pow(x, f->gamma) * (double) f->max);
+	return val > 0 ? val : 1;
+}
+
+/**
+ * follow_put:
+ * @ctx:	followers of the leader
+ * @vals:	frame of the leader
+ * @n:		number of values
+ *
+ * Frame writer that writes the leader, then every follower whose
+ * value changed, so they all move within the same frame.
+ *
+ * Returns: true if the leader was written, false otherwise
+ **/
+static bool follow_put(void *ctx, const int64_t *vals, int n)
+{
+	struct follow *fl = ctx;
+
+	if (!(fl->put ? fl->put(fl->ctx, vals, n) : file_rewrite(fl->fd, vals, n)))
+		return false;
+
+	for (int i = 0; i < fl->n; i++) {
+		struct follower *f = &fl->follower[i];
+		int64_t raw = follow_raw(f, vals[0], fl->max);
+
+		if (raw == f->last)
+			continue;
+		if (file_rewrite(f->fd, &raw, 1))
+			f->last = raw;
+		else
+			vlog_warning("writing follower '%s' failed", f->conf->ctrl);
+	}
+
+	return true;
+}
+
+/**
+ * follow_new:
+ * @leader:	configuration object of the leader
+ * @fd:		opened brightness of the leader
+ * @max:	raw maximum of the leader
+ * @fade:	fade whose frames the followers are chained behind
+ *
+ * Resolves the followers of leader from the configuration, given as
+ * "follow.<target>/<controller> <target>/<leader> [low high gamma]"
+ * lines, and chains them behind the frame writer of fade.
+ *
+ * Returns: the followers, or NULL if there are none
+ **/
+struct follow *follow_new(struct light_conf *leader, int fd, int64_t max,
+			  struct file_fade *fade)
+{
+	struct follow *fl = NULL;
+	const char *key, *val;
+	char lkey[CFG_VAL_MAX], want[CFG_VAL_MAX];
+	int pos = 0;
+
+	if (max <= 0 || snprintf(want, sizeof(want), "%s/%s",
+				 leader->target == LIGHT_KEYBOARD ? "leds" : "backlight",
+				 leader->ctrl) >= (int) sizeof(want))
+		return NULL;
+
+	while ((key = cfg_next(FOLLOW_PREFIX, &pos, &val))) {
+		struct follower f = { .low = 0, .high = 100, .gamma = 1 };
+
+		if (sscanf(val, "%191s %lf %lf %lf", lkey, &f.low, &f.high, &f.gamma) < 1 ||
+		    strcmp(lkey, want) != 0)
+			continue;
+
+		if (f.low < 0 || f.high <= f.low || f.high > 100 || f.gamma <= 0) {
+			vlog_warning("configuration: '%s' needs 0 <= low < high <= 100 and gamma > 0", key);
+			continue;
+		}
+
+		if (!fl && !(fl = calloc(1, sizeof(*fl)))) {
+			vlog_err("calloc: %m");
+			return NULL;
+		}
+
+		if (fl->n == FOLLOW_MAX) {
+			vlog_warning("'%s' has more than %d followers", want, FOLLOW_MAX);
+			break;
+		}
+
+		key += strlen(FOLLOW_PREFIX);
+		if (!follow_open(&f, key)) {
+			vlog_warning("can't open follower '%s'", key);
+			continue;
+		}
+
+		vlog_info("'%s' follows '%s'", key, want);
+		fl->follower[fl->n++] = f;
+	}
+
+	if (!fl || fl->n == 0) {
+		free(fl);
+		return NULL;
+	}
+
+	fl->fd = fd;
+	fl->max = max;
+	fl->put = fade->put;
+	fl->ctx = fade->ctx;
+	fade->put = follow_put;
+	fade->ctx = fl;
+
+	return fl;
+}
+
+/**
+ * follow_free:
+ * @fl:		followers to close, may be NULL
+ **/
+void follow_free(struct follow *fl)
+{
+	if (!fl)
+		return;
+
+	for (int i = 0; i < fl->n; i++) {
+		close(fl->follower[i].fd);
+		light_free(&fl->follower[i].conf);
+	}
+
+	free(fl);
+}
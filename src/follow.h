@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stdint.h>
+
+#include "light.h"
+#include "file.h"
+
+struct follow;
+
+struct follow *follow_new(struct light_conf *leader, int fd, int64_t max,
+			  struct file_fade *fade);
+void follow_free(struct follow *fl);
+
+#endif /* FOLLOW_H */
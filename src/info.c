@@ -4,29 +4,37 @@
 
 #include "burno.h"
 #include "vlog.h"
+#include "path.h"
 #include "ctrl.h"
 #include "light.h"
 #include "info.h"
 
 /**
  * info_list:
- * @prefix:	sysfs prefix to walk through
+ * @conf:	configuration object with the sysfs prefix to walk through
  *
- * Prints controller names in the specified prefix.
+ * Prints controller names in the sysfs prefix, followed by
+ * the DDC/CI displays for backlights.
  *
  * Returns: false if could not list controllers or no
  *	      controllers found, otherwise true
  **/
-bool info_list(char *prefix)
+bool info_list(struct light_conf *conf)
 {
-	burn_dir dir = opendir(prefix);
+	burn_dir dir = opendir(conf->sys_prefix);
+	burn_dir dev = NULL;
 
 	if (!dir) {
 		vlog_err("opendir: %m");
 		return false;
 	}
 
-	for (char *c; (c = ctrl_iter_next(dir)); free(c))
+	for (char *c; (c = ctrl_iter_next(dir)); path_free(c))
+		printf("%s\n", c);
+
+	/* listing never probes, it only shows displays found before */
+	dev = ctrl_ddc_dir(conf);
+	for (char *c; (c = ctrl_ddc_next(conf, dev, false)); path_free(c))
 		printf("%s\n", c);
 
 	return true;
@@ -48,7 +56,7 @@ bool info_help()
 /**
  * info_print:
  * @op:		operation mode to use
- * @prefix:	sysfs prefix to hand to list controllers
+ * @conf:	configuration object to hand to list controllers
  * @exec:	whether or not to take action
  *
  * If exec is true, prints information
@@ -56,7 +64,7 @@ bool info_help()
  *
  * Returns: true if op_mode is an info mode, otherwise false
  **/
-bool info_print(LIGHT_OP_MODE op, char *prefix, bool exec)
+bool info_print(LIGHT_OP_MODE op, struct light_conf *conf, bool exec)
 {
 	switch (op) {
 		case LIGHT_PRINT_HELP:
@@ -69,7 +77,7 @@ bool info_print(LIGHT_OP_MODE op, char *prefix, bool exec)
 			break;
 		case LIGHT_LIST_CTRL:
 			if (exec)
-				info_list(prefix);
+				info_list(conf);
 			break;
 		default:
 			return false;
@@ -6,6 +6,6 @@
 #include "light.h"
 
 bool info_help(void);
-bool info_print(LIGHT_OP_MODE op, char *prefix, bool exec);
+bool info_print(LIGHT_OP_MODE op, struct light_conf *conf, bool exec);
 
 #endif /* INFO_H */
@@ -2,106 +2,162 @@
 
 #include <sys/stat.h>
 #include <errno.h>
+#include <string.h>
 
 #include "common.h"
 #include "vlog.h"
 #include "path.h"
-#include "info.h"
 #include "ctrl.h"
 #include "light.h"
+#include "init.h"
+
+/**
+ * init_target:
+ * @conf:	light configuration object
+ *
+ * Returns: either "leds" or "backlight", or NULL for an unset target
+ **/
+static const char *init_target(struct light_conf *conf)
+{
+	if (conf->target == LIGHT_BACKLIGHT)
+		return "backlight";
+	if (conf->target == LIGHT_KEYBOARD)
+		return "leds";
+
+	vlog_err("no target to initialize");
+	return NULL;
+}
 
 /**
  * init_sys:
- * @tgt:	either "leds" or "backlight"
+ * @conf:	light configuration object
  *
- * Initializes the sysfs prefix string.
+ * Resolves the sysfs prefix string on first use.
  *
- * Returns: pointer to allocated prefix, or NULL on failure
+ * Returns: the prefix, or NULL on failure
  **/
-static char *init_sys(const char *tgt)
+char *init_sys(struct light_conf *conf)
 {
-	char *s;
+	const char *tgt;
+
+	if (conf->sys_prefix)
+		return conf->sys_prefix;
 
-	if (!(s = path_new()))
+	if (!(tgt = init_target(conf)) || !(conf->sys_prefix = path_new()))
 		return NULL;
 
-	return path_append(s, "/sys/class/%s", tgt);
+	return conf->sys_prefix = path_append(conf->sys_prefix, "%s/class/%s",
+					      path_sysfs(), tgt);
 }
 
 /**
  * init_cache:
- * @tgt:	either "leds" or "backlight"
+ * @conf:	light configuration object
+ * @create:	whether the cache dir has to exist
  *
- * Initializes the cache prefix string,
- * attempts to create the directory.
+ * Resolves the cache prefix string on first use. The directory
+ * is only created once something is about to be stored in it.
  *
- * Returns: pointer to allocated prefix, or NULL on failure
+ * Returns: the prefix, or NULL on failure
  **/
-static char *init_cache(const char * const tgt)
+char *init_cache(struct light_conf *conf, bool create)
 {
-	char *s;
-	const char *env, *dirfmt;
-	int r;
-
-	if ((geteuid() == 0 && (env = "/var/cache")) || 
-	    (env = getenv("XDG_CACHE_HOME")))
-		dirfmt = "%s/" PROG;
-	else if ((env = getenv("HOME")))
-		dirfmt = "%s/.cache/" PROG;
-
-	if (!env) {
-		vlog_err("XDG/HOME env vars not set, failed to init cache");
-		return NULL;
+	static bool made = false;
+	const char *tgt, *env, *dirfmt = NULL;
+	char *dir;
+
+	if (!conf->cache_prefix) {
+		if ((geteuid() == 0 && (env = "/var/cache")) ||
+		    (env = getenv("XDG_CACHE_HOME")))
+			dirfmt = "%s/" PROG;
+		else if ((env = getenv("HOME")))
+			dirfmt = "%s/.cache/" PROG;
+
+		if (!env) {
+			vlog_err("XDG/HOME env vars not set, failed to init cache");
+			return NULL;
+		}
+
+		if (!(tgt = init_target(conf)) || !(conf->cache_prefix = path_new()) ||
+		    !(conf->cache_prefix = path_append(conf->cache_prefix, dirfmt, env)) ||
+		    !(conf->cache_prefix = path_append(conf->cache_prefix, "/%s", tgt)))
+			return NULL;
 	}
 
-	if (!(s = path_new()))
-		return NULL;
-
-	if (!(s = path_append(s, dirfmt, env)))
-		return NULL;
+	if (!create || made)
+		return conf->cache_prefix;
 
-	/* make the cache dir */
-	r = mkdir(s, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+	/* the prefix is the dir followed by the target */
+	dir = strrchr(conf->cache_prefix, '/');
+	*dir = '\0';
 
 	/* warn now, the exec will fail later if necessary */
-	if (r != 0 && errno != EEXIST)
+	if (mkdir(conf->cache_prefix, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 &&
+	    errno != EEXIST)
 		vlog_warning("mkdir: %m");
 
-	return path_append(s, "/%s", tgt);
+	*dir = '/';
+	made = true;
+
+	return conf->cache_prefix;
 }
 
 /**
- * init_strings:
- * @conf:	light configuration object to initialize
+ * init_run:
+ * @conf:	light configuration object
+ * @create:	whether the runtime dir has to exist
  *
- * Initializes sys/cache prefixes and controller string.
+ * Resolves the prefix of state that every user of the controllers
+ * obeys on first use. Its directory is below the runtime directory,
+ * where only root may create it.
  *
- * Returns: true on success, false on failure
+ * Returns: the prefix, or NULL on failure
  **/
-bool init_strings(struct light_conf *conf)
+char *init_run(struct light_conf *conf, bool create)
 {
 	const char *tgt;
+	char *dir;
 
-	if (conf->target == LIGHT_BACKLIGHT)
-		tgt = "backlight";
-	else if (conf->target == LIGHT_KEYBOARD)
-		tgt = "leds";
-	else
-		return false;
+	if (!conf->run_prefix &&
+	    (!(tgt = init_target(conf)) || !(conf->run_prefix = path_new()) ||
+	     !(conf->run_prefix = path_append(conf->run_prefix, "%s/" PROG "/%s",
+					      path_run(), tgt))))
+		return NULL;
 
-	if (!(conf->sys_prefix = init_sys(tgt)))
-		return false;
+	if (!create)
+		return conf->run_prefix;
 
-	/* info mode needs no more initialization */
-	if (info_print(conf->op_mode, conf->sys_prefix, false))
-		return true;
+	/* the prefix is the dir followed by the target */
+	dir = strrchr(conf->run_prefix, '/');
+	*dir = '\0';
 
-	if (!(conf->cache_prefix = init_cache(tgt)))
-		return false;
+	if (mkdir(conf->run_prefix, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 &&
+	    errno != EEXIST) {
+		vlog_err("mkdir '%s': %m", conf->run_prefix);
+		*dir = '/';
+		return NULL;
+	}
+
+	*dir = '/';
+	return conf->run_prefix;
+}
 
-	/* Make sure we have a valid controller before we proceed */
-	if ((conf->ctrl_mode == LIGHT_CTRL_ALL) || conf->ctrl || ctrl_auto(conf))
+/**
+ * init_ctrl:
+ * @conf:	light configuration object
+ *
+ * Picks a controller on first use, unless one was given or every
+ * controller is acted on.
+ *
+ * Returns: true if conf holds a controller, false otherwise
+ **/
+bool init_ctrl(struct light_conf *conf)
+{
+	if (conf->ctrl)
 		return true;
 
-	return false;
+	if (conf->ctrl_mode == LIGHT_CTRL_ALL || !init_sys(conf))
+		return false;
+
+	return ctrl_auto(conf);
 }
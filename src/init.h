@@ -5,6 +5,11 @@
 
 #include <stdbool.h>
 
-bool init_strings(struct light_conf *conf);
+#include "light.h"
+
+char *init_sys(struct light_conf *conf);
+char *init_cache(struct light_conf *conf, bool create);
+char *init_run(struct light_conf *conf, bool create);
+bool init_ctrl(struct light_conf *conf);
 
 #endif /* INIT_H */
@@ -0,0 +1,508 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/input.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "ctrl.h"
+#include "light.h"
+#include "value.h"
+#include "init.h"
+#include "exec.h"
+#include "cfg.h"
+#include "input.h"
+
+#define INPUT_DIR "input"
+#define INPUT_DEVICES_MAX 64
+#define INPUT_EVENTS_MAX 64
+#define INPUT_STEP_DEFAULT "5"
+#define INPUT_ACCEL_REPEATS 5
+#define INPUT_ACCEL_MAX 4
+#define INPUT_IDLE_DIM_DEFAULT "10"
+#define INPUT_IDLE_FADE_USEC 1000000
+#define INPUT_WAKE_FADE_USEC 250000
+
+#define INPUT_BITS_LONG (8 * sizeof(long))
+#define INPUT_BITS_LEN(n) (((n) + INPUT_BITS_LONG - 1) / INPUT_BITS_LONG)
+#define INPUT_BIT_SET(bits, n) ((bits)[(n) / INPUT_BITS_LONG] & (1UL << ((n) % INPUT_BITS_LONG)))
+
+/**
+ * input_ctx:
+ *
+ * State of the input mode: the opened event devices, the display and
+ * keyboard controllers, what they were set to before going idle and
+ * the keyboard level the toggle key turned off.
+ **/
+struct input_ctx {
+	int epfd;
+	int timerfd;
+	int notifyfd;
+	int fds[INPUT_DEVICES_MAX];
+	char *names[INPUT_DEVICES_MAX];
+	struct light_conf *display;
+	struct light_conf *keyboard;
+	int64_t step;
+	int64_t idle_sec;
+	int64_t idle_dim;
+	int64_t repeats;
+	int64_t kbd_saved;
+	int64_t kbd_toggled;
+	int64_t display_saved;
+	bool idle;
+	struct timespec last;
+};
+
+static volatile sig_atomic_t input_stop = 0;
+
+static void input_signal(int sig)
+{
+	(void) sig;
+	input_stop = 1;
+}
+
+/**
+ * input_device_open:
+ * @ctx:	input context
+ * @name:	name of the device below the input directory
+ *
+ * Opens an event device and adds it to the epoll set if it can
+ * report keys or pointer motion. Devices that do not answer the
+ * capability ioctl are watched as well.
+ **/
+static void input_device_open(struct input_ctx *ctx, const char *name)
+{
+	unsigned long evbits[INPUT_BITS_LEN(EV_MAX + 1)] = { 0 };
+	burn_path p = path_new();
+	int slot = -1, fd;
+
+	if (strncmp(name, "event", 5) != 0 || !p ||
+	    !(p = path_append(p, "%s/" INPUT_DIR "/%s", path_dev(), name)))
+		return;
+
+	for (int i = 0; i < INPUT_DEVICES_MAX; i++) {
+		if (ctx->names[i] && strcmp(ctx->names[i], name) == 0)
+			return;
+		if (ctx->fds[i] < 0 && slot < 0)
+			slot = i;
+	}
+
+	if (slot < 0) {
+		vlog_warning("too many input devices, ignoring '%s'", name);
+		return;
+	}
+
+	if ((fd = open(p, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+		vlog_info("open '%s': %m", p);
+		return;
+	}
+
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) >= 0 &&
+	    !INPUT_BIT_SET(evbits, EV_KEY) && !INPUT_BIT_SET(evbits, EV_REL) &&
+	    !INPUT_BIT_SET(evbits, EV_ABS)) {
+		close(fd);
+		return;
+	}
+
+	if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd,
+		      &(struct epoll_event) { .events = EPOLLIN, .data.fd = fd }) < 0 ||
+	    !(ctx->names[slot] = strdup(name))) {
+		vlog_err("watching '%s': %m", p);
+		close(fd);
+		return;
+	}
+
+	ctx->fds[slot] = fd;
+	vlog_info("watching input device '%s'", p);
+}
+
+/**
+ * input_device_close:
+ * @ctx:	input context
+ * @fd:		fd of the device that went away
+ **/
+static void input_device_close(struct input_ctx *ctx, int fd)
+{
+	for (int i = 0; i < INPUT_DEVICES_MAX; i++) {
+		if (ctx->fds[i] != fd)
+			continue;
+		vlog_info("input device '%s' went away", ctx->names[i]);
+		free(ctx->names[i]);
+		ctx->names[i] = NULL;
+		ctx->fds[i] = -1;
+	}
+	close(fd);
+}
+
+/**
+ * input_idle_arm:
+ * @ctx:	input context
+ *
+ * Arms the idle timer for the idle timeout past the last activity.
+ * The timer is not re-armed on every event; when it fires early,
+ * it is simply pushed back.
+ **/
+static void input_idle_arm(struct input_ctx *ctx)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	its.it_value = ctx->last;
+	its.it_value.tv_sec += (time_t) ctx->idle_sec;
+
+	if (timerfd_settime(ctx->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		vlog_err("timerfd_settime: %m");
+}
+
+/**
+ * input_idle:
+ * @ctx:	input context
+ *
+ * Called when the idle timer fires: dims the display and turns off
+ * the keyboard backlight if there was no activity in the meantime.
+ * The timer stays disarmed until the next activity.
+ **/
+static void input_idle(struct input_ctx *ctx)
+{
+	struct timespec now;
+	uint64_t expirations;
+
+	if (read(ctx->timerfd, &expirations, sizeof(expirations)) < 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((int64_t) (now.tv_sec - ctx->last.tv_sec) * 1000000000 + now.tv_nsec - ctx->last.tv_nsec <
+	    ctx->idle_sec * 1000000000) {
+		input_idle_arm(ctx);
+		return;
+	}
+
+	vlog_notice("idle for %" PRId64 " seconds, dimming", ctx->idle_sec);
+	ctx->idle = true;
+
+	if (init_ctrl(ctx->display)) {
+		int64_t max = light_fetch(ctx->display, LIGHT_MAX_BRIGHTNESS);
+		int64_t dim = value_to_raw(LIGHT_PERCENT, ctx->idle_dim, max);
+
+		ctx->display_saved = light_fetch(ctx->display, LIGHT_BRIGHTNESS);
+		if (max > 0 && ctx->display_saved > dim)
+			exec_apply(ctx->display, LIGHT_SET, LIGHT_RAW, dim,
+				   ctx->display->usec ? ctx->display->usec : INPUT_IDLE_FADE_USEC);
+		else
+			ctx->display_saved = -1;
+	}
+
+	if (ctx->keyboard) {
+		ctx->kbd_saved = light_fetch(ctx->keyboard, LIGHT_BRIGHTNESS);
+		if (ctx->kbd_saved > 0)
+			exec_apply(ctx->keyboard, LIGHT_SET, LIGHT_RAW, 0, 0);
+		else
+			ctx->kbd_saved = -1;
+	}
+}
+
+/**
+ * input_wake:
+ * @ctx:	input context
+ *
+ * Restores what input_idle() dimmed.
+ **/
+static void input_wake(struct input_ctx *ctx)
+{
+	vlog_notice("activity, restoring brightness");
+	ctx->idle = false;
+
+	if (ctx->display_saved >= 0)
+		exec_apply(ctx->display, LIGHT_SET, LIGHT_RAW, ctx->display_saved,
+			   INPUT_WAKE_FADE_USEC);
+	if (ctx->keyboard && ctx->kbd_saved >= 0)
+		exec_apply(ctx->keyboard, LIGHT_SET, LIGHT_RAW, ctx->kbd_saved, 0);
+
+	ctx->display_saved = ctx->kbd_saved = -1;
+}
+
+/**
+ * input_key:
+ * @ctx:	input context
+ * @ev:		key event
+ *
+ * Applies a brightness key. Repeats grow the display step, up to
+ * INPUT_ACCEL_MAX times the configured one.
+ **/
+static void input_key(struct input_ctx *ctx, const struct input_event *ev)
+{
+	int64_t accel, raw;
+	struct light_conf *kbd = ctx->keyboard;
+
+	if (ev->value == 0) {
+		ctx->repeats = 0;
+		return;
+	}
+
+	ctx->repeats = ev->value == 2 ? ctx->repeats + 1 : 0;
+	accel = 1 + ctx->repeats / INPUT_ACCEL_REPEATS;
+	if (accel > INPUT_ACCEL_MAX)
+		accel = INPUT_ACCEL_MAX;
+
+	switch (ev->code) {
+	case KEY_BRIGHTNESSUP:
+		exec_apply(ctx->display, LIGHT_ADD, ctx->display->val_mode, ctx->step * accel, 0);
+		break;
+	case KEY_BRIGHTNESSDOWN:
+		exec_apply(ctx->display, LIGHT_SUB, ctx->display->val_mode, ctx->step * accel, 0);
+		break;
+	case KEY_KBDILLUMUP:
+		if (kbd)
+			exec_apply(kbd, LIGHT_ADD, LIGHT_RAW, 1, 0);
+		break;
+	case KEY_KBDILLUMDOWN:
+		if (kbd)
+			exec_apply(kbd, LIGHT_SUB, LIGHT_RAW, 1, 0);
+		break;
+	case KEY_KBDILLUMTOGGLE:
+		if (!kbd || ev->value != 1 || (raw = light_fetch(kbd, LIGHT_BRIGHTNESS)) < 0)
+			break;
+		if (raw > 0) {
+			ctx->kbd_toggled = raw;
+			exec_apply(kbd, LIGHT_SET, LIGHT_RAW, 0, 0);
+		} else {
+			exec_apply(kbd, LIGHT_SET, LIGHT_RAW, ctx->kbd_toggled > 0 ? ctx->kbd_toggled : 1, 0);
+			ctx->kbd_toggled = -1;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * input_active:
+ * @ctx:	input context
+ *
+ * Notes input activity, restoring what input_idle() dimmed before
+ * any key of the same read is applied on top of it.
+ **/
+static void input_active(struct input_ctx *ctx)
+{
+	if (ctx->idle_sec <= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx->last);
+	if (ctx->idle) {
+		input_wake(ctx);
+		input_idle_arm(ctx);
+	}
+}
+
+/**
+ * input_read:
+ * @ctx:	input context
+ * @fd:		event device with pending events
+ **/
+static void input_read(struct input_ctx *ctx, int fd)
+{
+	struct input_event evs[INPUT_EVENTS_MAX];
+	ssize_t r;
+	bool active = false;
+
+	while ((r = read(fd, evs, sizeof(evs))) > 0) {
+		for (size_t i = 0; i < (size_t) r / sizeof(evs[0]); i++) {
+			if (evs[i].type == EV_SYN || evs[i].type == EV_MSC)
+				continue;
+			if (!active)
+				input_active(ctx);
+			active = true;
+			if (evs[i].type == EV_KEY)
+				input_key(ctx, &evs[i]);
+		}
+	}
+
+	if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+		input_device_close(ctx, fd);
+}
+
+/**
+ * input_hotplug:
+ * @ctx:	input context
+ *
+ * Picks up event devices created after startup, such as uinput ones.
+ **/
+static void input_hotplug(struct input_ctx *ctx)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t r;
+
+	while ((r = read(ctx->notifyfd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + r;) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			if (ev->len > 0)
+				input_device_open(ctx, ev->name);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+/**
+ * input_keyboard_new:
+ *
+ * Sets up the keyboard backlight controller, taken from the
+ * keyboard.ctrl configuration key or detected automatically.
+ *
+ * Returns: keyboard configuration, or NULL if there is none
+ **/
+static struct light_conf *input_keyboard_new(void)
+{
+	const char *ctrl = cfg_get("keyboard.ctrl");
+	struct light_conf *kbd = light_new();
+
+	if (!kbd)
+		return NULL;
+
+	kbd->target = LIGHT_KEYBOARD;
+	kbd->op_mode = LIGHT_INPUT;
+	kbd->field = LIGHT_BRIGHTNESS;
+	kbd->ctrl_mode = LIGHT_CTRL_AUTO;
+	kbd->val_mode = LIGHT_RAW;
+	kbd->usec = 0;
+
+	if (ctrl && (!path_component(ctrl) || !(kbd->ctrl = strdup(ctrl)))) {
+		vlog_err("can't handle keyboard controller: '%s'", ctrl);
+		light_free(&kbd);
+		return NULL;
+	}
+
+	if (!init_ctrl(kbd)) {
+		vlog_warning("no keyboard backlight, ignoring its keys");
+		light_free(&kbd);
+		return NULL;
+	}
+
+	return kbd;
+}
+
+/**
+ * input_run:
+ * @conf:	configuration object of the display
+ *
+ * Handles brightness keys from the input devices in-process until
+ * interrupted. With idle.timeout configured, the same input activity
+ * dims the display and keyboard when idle and restores them on
+ * activity. Once dimmed, the process sleeps until the next input.
+ *
+ * Returns: true when stopped by a signal, false on failure
+ **/
+bool input_run(struct light_conf *conf)
+{
+	struct input_ctx ctx = {
+		.epfd = -1, .timerfd = -1, .notifyfd = -1,
+		.display = conf, .kbd_saved = -1, .kbd_toggled = -1, .display_saved = -1,
+	};
+	struct sigaction sa = { .sa_handler = input_signal };
+	const char *step = cfg_get("input.step");
+	const char *dim = cfg_get("idle.dim");
+	burn_path input = path_new();
+	burn_dir dir = NULL;
+	bool ret = true;
+
+	for (int i = 0; i < INPUT_DEVICES_MAX; i++)
+		ctx.fds[i] = -1;
+
+	if (!input || !(input = path_append(input, "%s/" INPUT_DIR, path_dev())))
+		return false;
+
+	ctx.idle_sec = cfg_int("idle.timeout", 0);
+	ctx.step = value_from_string(conf->val_mode, step ? step : INPUT_STEP_DEFAULT);
+	ctx.idle_dim = value_from_string(LIGHT_PERCENT, dim ? dim : INPUT_IDLE_DIM_DEFAULT);
+
+	if (ctx.step <= 0 || ctx.idle_dim < 0) {
+		vlog_err("configuration: invalid input.step or idle.dim");
+		return false;
+	}
+
+	if ((ctx.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    (ctx.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+	    (ctx.notifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		vlog_err("input setup: %m");
+		ret = false;
+	}
+
+	if (ret && (inotify_add_watch(ctx.notifyfd, input, IN_CREATE | IN_ATTRIB) < 0 ||
+		    epoll_ctl(ctx.epfd, EPOLL_CTL_ADD, ctx.notifyfd,
+			      &(struct epoll_event) { .events = EPOLLIN, .data.fd = ctx.notifyfd }) < 0 ||
+		    epoll_ctl(ctx.epfd, EPOLL_CTL_ADD, ctx.timerfd,
+			      &(struct epoll_event) { .events = EPOLLIN, .data.fd = ctx.timerfd }) < 0 ||
+		    !(dir = opendir(input)))) {
+		vlog_err("watching '%s': %m", input);
+		ret = false;
+	}
+
+	if (ret) {
+		for (char *c; (c = ctrl_iter_next(dir)); path_free(c))
+			input_device_open(&ctx, c);
+
+		ctx.keyboard = input_keyboard_new();
+
+		if (ctx.idle_sec > 0 && !init_ctrl(conf))
+			vlog_warning("idle dimming of the display needs a single controller");
+
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &ctx.last);
+		if (ctx.idle_sec > 0)
+			input_idle_arm(&ctx);
+	}
+
+	while (ret && !input_stop) {
+		struct epoll_event evs[8];
+		int n;
+
+		vlog_flush();
+		n = epoll_wait(ctx.epfd, evs, 8, -1);
+
+		if (n < 0 && errno != EINTR) {
+			vlog_err("epoll_wait: %m");
+			ret = false;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (evs[i].data.fd == ctx.timerfd)
+				input_idle(&ctx);
+			else if (evs[i].data.fd == ctx.notifyfd)
+				input_hotplug(&ctx);
+			else
+				input_read(&ctx, evs[i].data.fd);
+		}
+	}
+
+	if (ctx.idle)
+		input_wake(&ctx);
+
+	for (int i = 0; i < INPUT_DEVICES_MAX; i++) {
+		if (ctx.fds[i] >= 0)
+			close(ctx.fds[i]);
+		free(ctx.names[i]);
+	}
+
+	light_free(&ctx.keyboard);
+
+	if (ctx.notifyfd >= 0)
+		close(ctx.notifyfd);
+	if (ctx.timerfd >= 0)
+		close(ctx.timerfd);
+	if (ctx.epfd >= 0)
+		close(ctx.epfd);
+
+	return ret;
+}
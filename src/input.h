@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+
+#include "light.h"
+
+bool input_run(struct light_conf *conf);
+
+#endif /* INPUT_H */
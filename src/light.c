@@ -23,15 +23,20 @@ struct light_conf *light_new()
 	}
 
 	conf->ctrl = NULL;
+	conf->file = NULL;
 	conf->sys_prefix = NULL;
 	conf->cache_prefix = NULL;
+	conf->run_prefix = NULL;
 	conf->ctrl_mode = LIGHT_CTRL_UNSET;
 	conf->op_mode = LIGHT_OP_UNSET;
 	conf->val_mode = LIGHT_VAL_UNSET;
 	conf->target = LIGHT_TARGET_UNSET;
 	conf->field = LIGHT_FIELD_UNSET;
 	conf->value = 0;
+	conf->colors = 0;
 	conf->usec = 0;
+	conf->dither = false;
+	conf->defer = false;
 	conf->cached_max = 0;
 
 	return conf;
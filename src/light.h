@@ -3,15 +3,29 @@
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "path.h"
+
+#define LIGHT_COLORS_MAX 8
+
 typedef enum LIGHT_FIELD {
 	LIGHT_FIELD_UNSET = 0,
 	LIGHT_BRIGHTNESS,
 	LIGHT_MAX_BRIGHTNESS,
 	LIGHT_MIN_CAP,
-	LIGHT_SAVERESTORE
+	LIGHT_SAVERESTORE,
+	LIGHT_LATENCY,
+	LIGHT_MULTI_INTENSITY,
+	LIGHT_DDC,
+	LIGHT_TRIGGER,
+	LIGHT_PATTERN,
+	LIGHT_REPEAT,
+	LIGHT_BL_POWER,
+	LIGHT_DELTA,
+	LIGHT_MAX_CAP
 } LIGHT_FIELD;
 
 typedef enum LIGHT_TARGET {
@@ -37,7 +51,14 @@ typedef enum LIGHT_OP_MODE {
 	LIGHT_PRINT_VERSION,	/* Prints version info and exits */
 	LIGHT_LIST_CTRL,
 	LIGHT_RESTORE,
-	LIGHT_SAVE
+	LIGHT_SAVE,
+	LIGHT_CALIBRATE,
+	LIGHT_AMBIENT,
+	LIGHT_SCHEDULE,
+	LIGHT_INPUT,
+	LIGHT_REPORT,
+	LIGHT_ANIMATE,
+	LIGHT_THERMAL
 } LIGHT_OP_MODE;
 
 typedef enum LIGHT_VAL_MODE {
@@ -50,14 +71,20 @@ typedef enum LIGHT_VAL_MODE {
 struct light_conf {
 	char *sys_prefix;
 	char *cache_prefix;
+	char *run_prefix;
 	char *ctrl;
+	char *file;
 	LIGHT_CTRL_MODE ctrl_mode;
 	LIGHT_OP_MODE op_mode;
 	LIGHT_VAL_MODE val_mode;
 	LIGHT_TARGET target;
 	LIGHT_FIELD field;
 	int64_t value;
+	int64_t color[LIGHT_COLORS_MAX];
+	int colors;
 	int64_t usec;
+	bool dither;
+	bool defer;
 	int64_t cached_max;
 };
 
@@ -65,9 +92,11 @@ static inline void light_free(struct light_conf **conf)
 {
 	if (!(*conf))
 		return;
-	free((*conf)->ctrl);
-	free((*conf)->sys_prefix);
-	free((*conf)->cache_prefix);
+	path_free((*conf)->ctrl);
+	path_free((*conf)->file);
+	path_free((*conf)->sys_prefix);
+	path_free((*conf)->cache_prefix);
+	path_free((*conf)->run_prefix);
 	free(*conf);
 }
 
@@ -0,0 +1,500 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+
+#include "vlog.h"
+#include "path.h"
+#include "light.h"
+#include "logind.h"
+
+#define LOGIND_MSG_MAX 1024
+#define LOGIND_INFLIGHT_MAX 8
+#define LOGIND_TIMEOUT_MSEC 5000
+
+#define LOGIND_DEST "org.freedesktop.login1"
+#define LOGIND_PATH "/org/freedesktop/login1/session/auto"
+#define LOGIND_IFACE "org.freedesktop.login1.Session"
+
+/* message types and header fields of the D-Bus wire format */
+#define DBUS_CALL 1
+#define DBUS_RETURN 2
+#define DBUS_ERROR 3
+#define DBUS_PATH 1
+#define DBUS_INTERFACE 2
+#define DBUS_MEMBER 3
+#define DBUS_ERROR_NAME 4
+#define DBUS_REPLY_SERIAL 5
+#define DBUS_DESTINATION 6
+#define DBUS_SIGNATURE 8
+
+/**
+ * logind_msg:
+ *
+ * A message being marshalled, in native byte order. Once it does
+ * not fit, bad is set and the rest is dropped.
+ **/
+struct logind_msg {
+	uint8_t buf[LOGIND_MSG_MAX];
+	size_t len;
+	bool bad;
+};
+
+/*
+ * The connection to the system bus lives as long as the process, so
+ * long-running modes pay for the handshake once. Calls are sent
+ * without waiting for their replies, which are counted in inflight
+ * and read whenever the socket has some, or when too many pile up.
+ */
+static struct {
+	int fd;
+	int state;		/* 0 before connecting, 1 for an active session, -1 otherwise */
+	uint32_t serial;
+	uint32_t get_serial;
+	int inflight;
+	bool failed;
+	bool active;
+	uint8_t in[2 * LOGIND_MSG_MAX];
+	size_t in_len;
+} logind = { .fd = -1 };
+
+/**
+ * logind_endian:
+ *
+ * Returns: the byte order flag of messages in native byte order
+ **/
+static uint8_t logind_endian(void)
+{
+	static const uint16_t one = 1;
+
+	return *(const uint8_t *) &one ? 'l' : 'B';
+}
+
+static void logind_bytes(struct logind_msg *m, const void *p, size_t n)
+{
+	if (m->bad || m->len + n > sizeof(m->buf)) {
+		m->bad = true;
+		return;
+	}
+	memcpy(m->buf + m->len, p, n);
+	m->len += n;
+}
+
+static void logind_pad(struct logind_msg *m, size_t align)
+{
+	static const uint8_t zero[8] = { 0 };
+
+	logind_bytes(m, zero, (align - m->len % align) % align);
+}
+
+static void logind_u32(struct logind_msg *m, uint32_t v)
+{
+	logind_pad(m, 4);
+	logind_bytes(m, &v, sizeof(v));
+}
+
+static void logind_str(struct logind_msg *m, const char *s)
+{
+	logind_u32(m, (uint32_t) strlen(s));
+	logind_bytes(m, s, strlen(s) + 1);
+}
+
+static void logind_sig(struct logind_msg *m, const char *s)
+{
+	uint8_t n = (uint8_t) strlen(s);
+
+	logind_bytes(m, &n, 1);
+	logind_bytes(m, s, strlen(s) + 1);
+}
+
+/**
+ * logind_field:
+ * @m:		message being marshalled
+ * @code:	header field
+ * @type:	"o", "s" or "g"
+ * @val:	value of the field
+ **/
+static void logind_field(struct logind_msg *m, uint8_t code, const char *type, const char *val)
+{
+	logind_pad(m, 8);
+	logind_bytes(m, &code, 1);
+	logind_sig(m, type);
+	if (*type == 'g')
+		logind_sig(m, val);
+	else
+		logind_str(m, val);
+}
+
+/**
+ * logind_call:
+ * @dest:	bus name of the peer
+ * @path:	object path
+ * @iface:	interface
+ * @member:	method
+ * @sig:	signature of the arguments, made of 's' and 'u', or ""
+ * @strs:	arguments for each 's', in order
+ * @u:		argument for 'u'
+ *
+ * Sends a method call without waiting for its reply.
+ *
+ * Returns: the serial of the call, 0 on failure
+ **/
+static uint32_t logind_call(const char *dest, const char *path, const char *iface,
+			    const char *member, const char *sig, const char *const *strs,
+			    uint32_t u)
+{
+	struct logind_msg m = { .len = 0 };
+	uint8_t fixed[4] = { logind_endian(), DBUS_CALL, 0, 1 };
+	uint32_t serial = ++logind.serial, body_len, fields_len;
+	size_t body, off = 0;
+
+	logind_bytes(&m, fixed, sizeof(fixed));
+	logind_u32(&m, 0);
+	logind_u32(&m, serial);
+	logind_u32(&m, 0);
+
+	logind_field(&m, DBUS_PATH, "o", path);
+	logind_field(&m, DBUS_INTERFACE, "s", iface);
+	logind_field(&m, DBUS_MEMBER, "s", member);
+	logind_field(&m, DBUS_DESTINATION, "s", dest);
+	if (*sig)
+		logind_field(&m, DBUS_SIGNATURE, "g", sig);
+	fields_len = (uint32_t) (m.len - 16);
+	logind_pad(&m, 8);
+
+	body = m.len;
+	for (const char *c = sig; *c; c++) {
+		if (*c == 's')
+			logind_str(&m, *strs++);
+		else
+			logind_u32(&m, u);
+	}
+	body_len = (uint32_t) (m.len - body);
+
+	if (m.bad) {
+		vlog_err("D-Bus call '%s' too long", member);
+		return 0;
+	}
+
+	memcpy(m.buf + 4, &body_len, sizeof(body_len));
+	memcpy(m.buf + 12, &fields_len, sizeof(fields_len));
+
+	while (off < m.len) {
+		ssize_t r = send(logind.fd, m.buf + off, m.len - off, MSG_NOSIGNAL);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			vlog_err("send to system bus: %m");
+			return 0;
+		}
+		off += (size_t) r;
+	}
+
+	logind.inflight++;
+	return serial;
+}
+
+/**
+ * logind_u32_at:
+ * @p:		message
+ * @pos:	offset to read at, advanced past the value
+ * @end:	offset the value has to end by
+ * @v:		where to store the value
+ *
+ * Returns: true on success, false if the value is past end
+ **/
+static bool logind_u32_at(const uint8_t *p, size_t *pos, size_t end, uint32_t *v)
+{
+	size_t at = (*pos + 3) & ~(size_t) 3;
+
+	if (at > end || end - at < sizeof(*v))
+		return false;
+
+	memcpy(v, p + at, sizeof(*v));
+	*pos = at + sizeof(*v);
+	return true;
+}
+
+/**
+ * logind_handle:
+ * @p:		complete message in native byte order
+ * @fields_end:	offset the header fields end at
+ * @body:	offset the body starts at
+ * @total:	length of the message
+ *
+ * Accounts for a reply to one of our calls, and keeps the answer
+ * to whether the session is active. Malformed messages are ignored,
+ * nothing past fields_end or total is read.
+ **/
+static void logind_handle(const uint8_t *p, size_t fields_end, size_t body, size_t total)
+{
+	uint32_t reply = 0, v;
+	const char *error = NULL;
+	size_t pos = 16;
+
+	if (p[1] != DBUS_RETURN && p[1] != DBUS_ERROR)
+		return;
+
+	while (pos < fields_end) {
+		uint8_t code, type;
+
+		/* code, signature length, one type and its terminator */
+		pos = (pos + 7) & ~(size_t) 7;
+		if (pos > fields_end || fields_end - pos < 4 || p[pos + 1] != 1)
+			return;
+		code = p[pos];
+		type = p[pos + 2];
+		pos += 4;
+
+		if (type == 'u') {
+			if (!logind_u32_at(p, &pos, fields_end, &v))
+				return;
+			if (code == DBUS_REPLY_SERIAL)
+				reply = v;
+		} else if (type == 's' || type == 'o') {
+			if (!logind_u32_at(p, &pos, fields_end, &v) || fields_end - pos <= v ||
+			    p[pos + v] != '\0')
+				return;
+			if (code == DBUS_ERROR_NAME)
+				error = (const char *) p + pos;
+			pos += (size_t) v + 1;
+		} else if (type == 'g') {
+			if (pos >= fields_end || fields_end - pos < 2 + (size_t) p[pos])
+				return;
+			pos += 2 + (size_t) p[pos];
+		} else {
+			return;
+		}
+	}
+
+	if (reply == 0 || reply > logind.serial)
+		return;
+
+	logind.inflight--;
+
+	if (error) {
+		vlog_err("D-Bus call %" PRIu32 " failed: %s", reply, error);
+		logind.failed = true;
+	} else if (reply == logind.get_serial) {
+		/* a variant holding a boolean: "b", padding, the value */
+		size_t at = body + 3;
+		logind.active = total - body >= 3 && p[body] == 1 && p[body + 1] == 'b' &&
+				logind_u32_at(p, &at, total, &v) && v == 1;
+	}
+}
+
+/**
+ * logind_recv:
+ * @wait:	whether to wait for data if there is none
+ *
+ * Reads from the bus and handles every complete message.
+ *
+ * Returns: true on success, false on failure or timeout
+ **/
+static bool logind_recv(bool wait)
+{
+	struct pollfd pfd = { .fd = logind.fd, .events = POLLIN };
+	ssize_t r;
+
+	if (wait && poll(&pfd, 1, LOGIND_TIMEOUT_MSEC) <= 0) {
+		vlog_err("no reply from the system bus");
+		return false;
+	}
+
+	r = recv(logind.fd, logind.in + logind.in_len, sizeof(logind.in) - logind.in_len,
+		 wait ? 0 : MSG_DONTWAIT);
+	if (r < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return true;
+	if (r <= 0) {
+		vlog_err("recv from system bus: %s", r == 0 ? "connection closed" : strerror(errno));
+		return false;
+	}
+	logind.in_len += (size_t) r;
+
+	for (;;) {
+		uint32_t body_len, fields_len;
+		size_t pos = 4, body, total;
+
+		if (logind.in_len < 16)
+			return true;
+
+		if (logind.in[0] != logind_endian() || logind.in[3] != 1) {
+			vlog_err("unsupported D-Bus message");
+			return false;
+		}
+
+		logind_u32_at(logind.in, &pos, 16, &body_len);
+		pos = 12;
+		logind_u32_at(logind.in, &pos, 16, &fields_len);
+		body = (16 + (size_t) fields_len + 7) & ~(size_t) 7;
+		total = body + body_len;
+
+		if (total > sizeof(logind.in)) {
+			vlog_err("D-Bus message of %zu bytes too long", total);
+			return false;
+		}
+		if (logind.in_len < total)
+			return true;
+
+		logind_handle(logind.in, 16 + fields_len, body, total);
+		memmove(logind.in, logind.in + total, logind.in_len - total);
+		logind.in_len -= total;
+	}
+}
+
+/**
+ * logind_connect:
+ *
+ * Connects to the system bus, authenticates with the uid of the
+ * process and asks whether its logind session is active. The
+ * handshake, Hello and the question are sent in one go.
+ *
+ * Returns: true if the session is active, false otherwise
+ **/
+static bool logind_connect(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	const char *bus = path_bus();
+	const char *get[] = { LOGIND_IFACE, "Active" };
+	char uid[16], auth[64], line[128];
+	size_t len = 0, n;
+	ssize_t r;
+
+	if (strlen(bus) >= sizeof(sa.sun_path))
+		return false;
+	strcpy(sa.sun_path, bus);
+
+	if ((logind.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+	    connect(logind.fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		vlog_info("connect '%s': %m", bus);
+		return false;
+	}
+
+	/* the uid goes out as hex encoded decimal digits */
+	snprintf(uid, sizeof(uid), "%u", (unsigned int) geteuid());
+	auth[len++] = '\0';
+	len += (size_t) snprintf(auth + len, sizeof(auth) - len, "AUTH EXTERNAL ");
+	for (n = 0; uid[n]; n++)
+		len += (size_t) snprintf(auth + len, sizeof(auth) - len, "%02x", uid[n]);
+	len += (size_t) snprintf(auth + len, sizeof(auth) - len, "\r\n");
+
+	if (send(logind.fd, auth, len, MSG_NOSIGNAL) != (ssize_t) len)
+		return false;
+
+	for (len = 0; !memchr(line, '\n', len); len += (size_t) r) {
+		if (len == sizeof(line) ||
+		    (r = recv(logind.fd, line + len, sizeof(line) - len, 0)) <= 0)
+			return false;
+	}
+
+	if (strncmp(line, "OK ", 3) != 0) {
+		vlog_info("system bus refused authentication");
+		return false;
+	}
+
+	if (send(logind.fd, "BEGIN\r\n", 7, MSG_NOSIGNAL) != 7 ||
+	    !logind_call("org.freedesktop.DBus", "/org/freedesktop/DBus",
+			 "org.freedesktop.DBus", "Hello", "", NULL, 0) ||
+	    !(logind.get_serial = logind_call(LOGIND_DEST, LOGIND_PATH,
+					      "org.freedesktop.DBus.Properties", "Get",
+					      "ss", get, 0)) ||
+	    !logind_sync())
+		return false;
+
+	return logind.active;
+}
+
+/**
+ * logind_session:
+ *
+ * Connects to logind on first use.
+ *
+ * Returns: true if the caller has an active session to write through
+ **/
+bool logind_session(void)
+{
+	if (logind.state == 0) {
+		logind.state = logind_connect() ? 1 : -1;
+		if (logind.state < 0) {
+			vlog_info("no active logind session");
+			if (logind.fd >= 0)
+				close(logind.fd);
+			logind.fd = -1;
+		}
+	}
+
+	return logind.state > 0;
+}
+
+/**
+ * logind_open:
+ *
+ * Returns: a duplicate of the bus connection, -1 on failure
+ **/
+int logind_open(void)
+{
+	if (!logind_session())
+		return -1;
+
+	return fcntl(logind.fd, F_DUPFD_CLOEXEC, 0);
+}
+
+/**
+ * logind_put:
+ * @ctx:	configuration object of the controller
+ * @vals:	frame to write
+ * @n:		number of values, only the first is used
+ *
+ * Frame writer for file_write() that calls SetBrightness of the
+ * session, without waiting for the reply unless too many calls are
+ * in flight already. logind_sync() collects the outcome.
+ *
+ * Returns: true if the call was sent, false otherwise
+ **/
+bool logind_put(void *ctx, const int64_t *vals, int n)
+{
+	struct light_conf *conf = ctx;
+	const char *args[] = { conf->target == LIGHT_KEYBOARD ? "leds" : "backlight", conf->ctrl };
+	int64_t val = vals[0] < 0 ? 0 : vals[0] > UINT32_MAX ? UINT32_MAX : vals[0];
+
+	(void) n;
+
+	if (!logind_recv(false))
+		return false;
+
+	while (logind.inflight >= LOGIND_INFLIGHT_MAX) {
+		if (!logind_recv(true))
+			return false;
+	}
+
+	return logind_call(LOGIND_DEST, LOGIND_PATH, LOGIND_IFACE, "SetBrightness",
+			   "ssu", args, (uint32_t) val) != 0;
+}
+
+/**
+ * logind_sync:
+ *
+ * Waits for the replies to every call in flight.
+ *
+ * Returns: true if all of them succeeded, false otherwise
+ **/
+bool logind_sync(void)
+{
+	bool ok;
+
+	while (logind.inflight > 0) {
+		if (!logind_recv(true))
+			return false;
+	}
+
+	ok = !logind.failed;
+	logind.failed = false;
+	return ok;
+}
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef LOGIND_H
+#define LOGIND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool logind_session(void);
+int logind_open(void);
+bool logind_put(void *ctx, const int64_t *vals, int n);
+bool logind_sync(void);
+
+#endif /* LOGIND_H */
@@ -6,7 +6,6 @@
 #include "light.h"
 #include "vlog.h"
 #include "parse.h"
-#include "init.h"
 #include "exec.h"
 
 int main(int argc, char **argv)
@@ -21,11 +20,6 @@ int main(int argc, char **argv)
 		return 2;
 	}
 
-	if (!(init_strings(ctx))) {
-		vlog_err("initialization failed");
-		return EXIT_FAILURE;
-	}
-
 	if (!exec_op(ctx)) {
 		vlog_err("execution failed");
 		return EXIT_FAILURE;
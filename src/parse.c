@@ -53,29 +53,57 @@ static bool parse_check(LIGHT_OP_MODE op, LIGHT_FIELD field)
 			return true;
 		vlog_err("only use -G or -S with the min cap field");
 		return false;
+	case LIGHT_MULTI_INTENSITY:
+		if (op == LIGHT_GET || op == LIGHT_SET || op == LIGHT_ADD || op == LIGHT_SUB)
+			return true;
+		vlog_err("only use -G, -S, -A or -U with the multi intensity field");
+		return false;
 	default:
 		return true;
 	}
 }
 
+/**
+ * parse_colors:
+ * @value:	comma separated color components
+ * @ctx:	configuration object to store them in
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool parse_colors(char *value, struct light_conf *ctx)
+{
+	for (char *c = strtok(value, ","); c; c = strtok(NULL, ",")) {
+		if (ctx->colors == LIGHT_COLORS_MAX) {
+			vlog_err("more than %d color components", LIGHT_COLORS_MAX);
+			return info_help();
+		}
+		if ((ctx->color[ctx->colors++] = value_from_string(ctx->val_mode, c)) < 0) {
+			vlog_err("color component not recognizable: '%s'", c);
+			return info_help();
+		}
+	}
+
+	return ctx->colors > 0 ? true : info_help();
+}
+
 /**
  * parse_args:
  * @argc	argument count
  * @argv	argument array
  *
- * WARNING: may allocate a string in ctx->ctrl,
- *          but will not free it
+ * WARNING: may allocate strings in ctx->ctrl and ctx->file,
+ *          but will not free them
  *
  * Returns: a valid conf object on success, NULL on failure
  **/
 bool parse_args(int argc, char **argv, struct light_conf *ctx)
 {
 	int opt, level;
-	char *value = NULL, *ctrl = NULL;
+	char *value = NULL, *ctrl = NULL, *file = NULL;
 
 	level = -1;
 
-	while ((opt = getopt(argc, argv, "HhVGS:A:U:LIObmclkaes:pqrv:u:")) != -1) {
+	while ((opt = getopt(argc, argv, "HhVGS:A:U:LIOCXT:KRF:ZbmcilkaeDws:pqrv:u:")) != -1) {
 		switch (opt) {
 			/* -- Operations -- */
 		case 'H':
@@ -109,6 +137,29 @@ bool parse_args(int argc, char **argv, struct light_conf *ctx)
 		case 'O':
 			PARSE_SET_OP(LIGHT_SAVE);
 			break;
+		case 'C':
+			PARSE_SET_OP(LIGHT_CALIBRATE);
+			break;
+		case 'X':
+			PARSE_SET_OP(LIGHT_AMBIENT);
+			break;
+		case 'T':
+			PARSE_SET_OP(LIGHT_SCHEDULE);
+			file = optarg;
+			break;
+		case 'K':
+			PARSE_SET_OP(LIGHT_INPUT);
+			break;
+		case 'R':
+			PARSE_SET_OP(LIGHT_REPORT);
+			break;
+		case 'F':
+			PARSE_SET_OP(LIGHT_ANIMATE);
+			file = optarg;
+			break;
+		case 'Z':
+			PARSE_SET_OP(LIGHT_THERMAL);
+			break;
 
 			/* -- Targets -- */
 		case 'l':
@@ -128,6 +179,9 @@ bool parse_args(int argc, char **argv, struct light_conf *ctx)
 		case 'c':
 			PARSE_SET_FIELD(LIGHT_MIN_CAP);
 			break;
+		case 'i':
+			PARSE_SET_FIELD(LIGHT_MULTI_INTENSITY);
+			break;
 
 			/* -- Controller selection -- */
 		case 'a':
@@ -168,6 +222,12 @@ bool parse_args(int argc, char **argv, struct light_conf *ctx)
 				return info_help();
 			}
 			break;
+		case 'D':
+			ctx->dither = true;
+			break;
+		case 'w':
+			ctx->defer = true;
+			break;
 		default:
 			return info_help();
 		}
@@ -181,17 +241,45 @@ bool parse_args(int argc, char **argv, struct light_conf *ctx)
 	if (!parse_check(ctx->op_mode, ctx->field))
 		return info_help();
 
-	if (ctx->field != LIGHT_BRIGHTNESS && ctx->usec != 0) {
+	if (ctx->field != LIGHT_BRIGHTNESS && ctx->field != LIGHT_MULTI_INTENSITY &&
+	    ctx->usec != 0) {
 		vlog_warning("Resetting time to zero for non-brightness field");
 		ctx->usec = 0;
 	}
 
-	if (value &&
-	    (ctx->value = value_from_string(ctx->val_mode, value)) < 0) {
+	if ((ctx->op_mode == LIGHT_ANIMATE || ctx->op_mode == LIGHT_THERMAL) &&
+	    ctx->ctrl_mode == LIGHT_CTRL_ALL) {
+		vlog_err("-F and -Z act on a single controller, not with -e");
+		return info_help();
+	}
+
+	if (ctx->dither && (ctx->field != LIGHT_BRIGHTNESS ||
+			    (ctx->op_mode != LIGHT_SET && ctx->op_mode != LIGHT_ADD &&
+			     ctx->op_mode != LIGHT_SUB))) {
+		vlog_warning("Dithering only applies to setting the brightness");
+		ctx->dither = false;
+	}
+
+	if (ctx->defer && ctx->op_mode != LIGHT_SET && ctx->op_mode != LIGHT_ADD &&
+	    ctx->op_mode != LIGHT_SUB) {
+		vlog_warning("Waiting for the device only applies to setting it");
+		ctx->defer = false;
+	}
+
+	if (value && ctx->field == LIGHT_MULTI_INTENSITY) {
+		if (!parse_colors(value, ctx))
+			return false;
+	} else if (value &&
+		   (ctx->value = value_from_string(ctx->val_mode, value)) < 0) {
 		vlog_err("value not recognizable");
 		return info_help();
 	}
 
+	if (file && !(ctx->file = strdup(file))) {
+		vlog_err("strdup: %m");
+		return false;
+	}
+
 	if (ctrl && (!path_component(ctrl) || !(ctx->ctrl = strdup(ctrl)))) {
 		vlog_err("can't handle controller: '%s'", ctrl);
 		return info_help();
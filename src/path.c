@@ -6,6 +6,18 @@
 
 #include "common.h"
 #include "vlog.h"
+#include "path.h"
+
+#define PATH_SLOTS 32
+
+/*
+ * Paths are built in PATH_MAX slots of a static arena, so resolving
+ * and opening files costs no heap allocations. Slots are taken with
+ * path_new() and given back with path_free(), which also frees heap
+ * strings. Once every slot is taken, path_new() uses the heap.
+ */
+static char path_arena[PATH_SLOTS][PATH_MAX];
+static uint32_t path_used = 0;
 
 /**
  * path_component:
@@ -26,9 +38,17 @@ bool path_component(const char *c) {
  **/
 char *path_new()
 {
-	char *p;
+	char *p = NULL;
+
+	for (int i = 0; i < PATH_SLOTS; i++) {
+		if (!(path_used & UINT32_C(1) << i)) {
+			path_used |= UINT32_C(1) << i;
+			p = path_arena[i];
+			break;
+		}
+	}
 
-	if (!(p = malloc(PATH_MAX))) {
+	if (!p && !(p = malloc(PATH_MAX))) {
 		vlog_err("malloc: %m");
 		return NULL;
 	}
@@ -38,6 +58,22 @@ char *path_new()
 	return p;
 }
 
+/**
+ * path_free:
+ * @p:		path or other string to free, or NULL
+ *
+ * Gives a path back to the arena, or frees a string on the heap.
+ **/
+void path_free(void *p)
+{
+	char *c = p, *arena = path_arena[0];
+
+	if (c >= arena && c < arena + sizeof(path_arena))
+		path_used &= ~(UINT32_C(1) << (c - arena) / PATH_MAX);
+	else
+		free(p);
+}
+
 /**
  * path_append:
  * @str:	string to append to
@@ -52,15 +88,16 @@ char *path_new()
 char *path_append(char * const str, const char *fmt, ...)
 {
 	int r;
+	size_t len = strlen(str);
 	va_list ap;
 
 	va_start(ap, fmt);
 
-	r = vsnprintf(str + strlen(str), PATH_MAX - strlen(str), fmt, ap);
+	r = vsnprintf(str + len, PATH_MAX - len, fmt, ap);
 
-	if (r < 0 || (size_t)r >= (PATH_MAX - strlen(str))) {
+	if (r < 0 || (size_t)r >= PATH_MAX - len) {
 		vlog_err("snprintf");
-		free(str);
+		path_free(str);
 		va_end(ap);
 		return NULL;
 	}
@@ -68,3 +105,102 @@ char *path_append(char * const str, const char *fmt, ...)
 	va_end(ap);
 	return str;
 }
+
+/**
+ * path_sysfs:
+ *
+ * The sysfs mount point can be moved with the BRILLO_SYSFS
+ * environment variable so that a fake tree can be used for
+ * testing. It is ignored when running with elevated privileges.
+ *
+ * Returns: the sysfs mount point
+ **/
+const char *path_sysfs(void)
+{
+	const char *env = getenv("BRILLO_SYSFS");
+
+	if (!env || geteuid() != getuid() || getegid() != getgid())
+		return "/sys";
+
+	return env;
+}
+
+/**
+ * path_dev:
+ *
+ * Like path_sysfs(), for the device directory and BRILLO_DEV.
+ *
+ * Returns: the device directory
+ **/
+const char *path_dev(void)
+{
+	const char *env = getenv("BRILLO_DEV");
+
+	if (!env || geteuid() != getuid() || getegid() != getgid())
+		return "/dev";
+
+	return env;
+}
+
+/**
+ * path_run:
+ *
+ * Like path_sysfs(), for the runtime directory and BRILLO_RUN.
+ *
+ * Returns: the runtime directory
+ **/
+const char *path_run(void)
+{
+	const char *env = getenv("BRILLO_RUN");
+
+	if (!env || geteuid() != getuid() || getegid() != getgid())
+		return "/run";
+
+	return env;
+}
+
+/**
+ * path_bus:
+ *
+ * Like path_sysfs(), for the socket of the system bus, taken from
+ * the first "unix:path=" address in DBUS_SYSTEM_BUS_ADDRESS.
+ *
+ * Returns: the socket path
+ **/
+const char *path_bus(void)
+{
+	static char path[PATH_MAX];
+	const char *env = getenv("DBUS_SYSTEM_BUS_ADDRESS");
+	const char *s;
+	size_t len;
+
+	if (!env || geteuid() != getuid() || getegid() != getgid() ||
+	    !(s = strstr(env, "unix:path=")))
+		return "/run/dbus/system_bus_socket";
+
+	s += strlen("unix:path=");
+	if ((len = strcspn(s, ",;")) >= sizeof(path))
+		return "/run/dbus/system_bus_socket";
+
+	memcpy(path, s, len);
+	path[len] = '\0';
+	return path;
+}
+
+/**
+ * path_uevent:
+ *
+ * Like path_sysfs(), for BRILLO_UEVENT, a unix datagram socket that
+ * receives uevents in place of the kernel.
+ *
+ * Returns: the socket path, or NULL to listen to the kernel
+ **/
+const char *path_uevent(void)
+{
+	const char *env = getenv("BRILLO_UEVENT");
+
+	if (!env || geteuid() != getuid() || getegid() != getgid())
+		return NULL;
+
+	return env;
+}
@@ -3,11 +3,25 @@
 #ifndef PATH_H
 #define PATH_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdarg.h>
 
 bool path_component(const char *c);
 char *path_append(char * const str, const char *fmt, ...);
 char *path_new(void);
+void path_free(void *p);
+const char *path_sysfs(void);
+const char *path_dev(void);
+const char *path_bus(void);
+const char *path_run(void);
+const char *path_uevent(void);
+
+static inline void path__free(char **p)
+{
+	path_free(*p);
+}
+
+#define burn_path __attribute__((cleanup(path__free))) char *
 
 #endif /* PATH_H */
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <string.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "file.h"
+#include "cfg.h"
+#include "power.h"
+
+#define POWER_LOW_CAPACITY 15
+
+/**
+ * power_policies:
+ *
+ * Default fade policy per power state, in frames per second and
+ * microseconds of timer slack. Overridden by the <state>.rate and
+ * <state>.slack configuration keys.
+ **/
+static const struct {
+	const char *name;
+	int64_t rate;
+	int64_t slack;
+} power_policies[] = {
+	[POWER_UNKNOWN] = { "unknown", 60, 50 },
+	[POWER_AC] = { "ac", 120, 50 },
+	[POWER_BATTERY] = { "battery", 30, 5000 },
+	[POWER_LOW] = { "low", 15, 20000 },
+};
+
+/**
+ * power_state:
+ *
+ * Looks at the power supplies: any online mains adapter means AC,
+ * otherwise a battery below the low.capacity threshold means low.
+ *
+ * Returns: the current power state
+ **/
+POWER_STATE power_state(void)
+{
+	POWER_STATE state = POWER_UNKNOWN;
+	int64_t low = cfg_int("low.capacity", POWER_LOW_CAPACITY);
+	burn_path prefix = path_new();
+	burn_fd fd = -1;
+	struct file_dir dir = { .fd = -1 };
+
+	if (!prefix || !(prefix = path_append(prefix, "%s/class/power_supply", path_sysfs())))
+		return POWER_UNKNOWN;
+
+	if ((dir.fd = fd = open(prefix, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return POWER_UNKNOWN;
+
+	for (const char *c; (c = file_dir_next(&dir)); ) {
+		char type[32], val[32];
+		burn_path sup = path_new();
+		int64_t capacity;
+
+		if (!sup || !(sup = path_append(sup, "%s/%s", prefix, c)) ||
+		    !file_read_attr(sup, "type", type, sizeof(type)))
+			continue;
+
+		if (strcmp(type, "Battery") != 0) {
+			if (file_read_attr(sup, "online", val, sizeof(val)) && strcmp(val, "1") == 0)
+				state = POWER_AC;
+			continue;
+		}
+
+		if (state == POWER_AC || !file_read_attr(sup, "capacity", val, sizeof(val)) ||
+		    sscanf(val, "%" SCNd64, &capacity) != 1)
+			continue;
+
+		if (capacity <= low)
+			state = POWER_LOW;
+		else if (state != POWER_LOW)
+			state = POWER_BATTERY;
+	}
+
+	return state;
+}
+
+/**
+ * power_name:
+ * @state:	power state
+ *
+ * Returns: the name used for state in logs and configuration keys
+ **/
+const char *power_name(POWER_STATE state)
+{
+	return power_policies[state].name;
+}
+
+/**
+ * power_policy:
+ * @state:	power state to apply the policy of
+ * @fade:	fade to apply the policy to
+ *
+ * Limits the frame rate of fade to the one of the power state
+ * and sets its timer slack.
+ **/
+void power_policy(POWER_STATE state, struct file_fade *fade)
+{
+	char key[32];
+	int64_t rate;
+
+	snprintf(key, sizeof(key), "%s.rate", power_name(state));
+	rate = cfg_int(key, power_policies[state].rate);
+
+	snprintf(key, sizeof(key), "%s.slack", power_name(state));
+	fade->slack = cfg_int(key, power_policies[state].slack);
+
+	if (rate > 0 && (fade->rate == 0 || rate < fade->rate))
+		fade->rate = rate;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "file.h"
+
+typedef enum POWER_STATE {
+	POWER_UNKNOWN = 0,
+	POWER_AC,
+	POWER_BATTERY,
+	POWER_LOW
+} POWER_STATE;
+
+POWER_STATE power_state(void);
+const char *power_name(POWER_STATE state);
+void power_policy(POWER_STATE state, struct file_fade *fade);
+
+#endif /* POWER_H */
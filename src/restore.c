@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+/*
+ * Restore/set-only variant for early boot. It shares the cache layout
+ * and the linear percent scale of the full program, but none of its
+ * code: no libm, no stdio, no allocations, and sysfs is reached with
+ * openat() relative to the class directory.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RESTORE_PATH_MAX 256
+#define RESTORE_PCT_MAX 10000
+#define RESTORE_USAGE "usage: [-k] [-s ctrl] -I | [-r] -S value"
+
+/**
+ * restore_err:
+ * @msg:	message
+ * @arg:	argument to append to the message, or NULL
+ *
+ * Returns: false
+ **/
+static bool restore_err(const char *msg, const char *arg)
+{
+	char buf[RESTORE_PATH_MAX * 2];
+	size_t len = 0;
+	const char *parts[] = { PROG "-restore: ", msg, arg ? arg : "", "\n" };
+
+	for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+		size_t n = strlen(parts[i]);
+		if (len + n > sizeof(buf))
+			n = sizeof(buf) - len;
+		memcpy(buf + len, parts[i], n);
+		len += n;
+	}
+
+	/* nowhere left to report a failure to */
+	if (write(STDERR_FILENO, buf, len) < 0)
+		return false;
+
+	return false;
+}
+
+/**
+ * restore_exit:
+ * @code:	exit status
+ * @msg:	message
+ * @arg:	argument to append to the message, or NULL
+ *
+ * Returns: code
+ **/
+static int restore_exit(int code, const char *msg, const char *arg)
+{
+	restore_err(msg, arg);
+	return code;
+}
+
+/**
+ * restore_cat:
+ * @buf:	buffer of RESTORE_PATH_MAX bytes
+ * @...:	strings to concatenate into buf, ending with NULL
+ *
+ * Returns: true on success, false if the result does not fit
+ **/
+static bool restore_cat(char *buf, ...)
+{
+	size_t len = 0;
+	const char *s;
+	va_list ap;
+
+	va_start(ap, buf);
+	while ((s = va_arg(ap, const char *))) {
+		size_t n = strlen(s);
+		if (len + n >= RESTORE_PATH_MAX) {
+			va_end(ap);
+			return false;
+		}
+		memcpy(buf + len, s, n);
+		len += n;
+	}
+	va_end(ap);
+
+	buf[len] = '\0';
+	return true;
+}
+
+/**
+ * restore_parse:
+ * @s:		decimal string, with up to two fractional digits if pct
+ * @pct:	whether s is a percentage
+ *
+ * Returns: the value, in hundredths of a percent if pct, or -1
+ **/
+static int64_t restore_parse(const char *s, bool pct)
+{
+	int64_t val = 0;
+	int frac = -1;
+
+	if (!*s)
+		return -1;
+
+	for (; *s && *s != '\n'; s++) {
+		if (*s == '.' && pct && frac < 0) {
+			frac = 0;
+			continue;
+		}
+		if (*s < '0' || *s > '9' || val > INT64_MAX / 100)
+			return -1;
+		if (frac >= 2)
+			continue;
+		if (frac >= 0)
+			frac++;
+		val = val * 10 + (*s - '0');
+	}
+
+	if (!pct)
+		return val;
+
+	for (frac = frac < 0 ? 0 : frac; frac < 2; frac++)
+		val *= 10;
+
+	return val > RESTORE_PCT_MAX ? RESTORE_PCT_MAX : val;
+}
+
+/**
+ * restore_read:
+ * @dfd:	directory the path is relative to
+ * @path:	path of the value
+ *
+ * Returns: the value, or -1 on failure
+ **/
+static int64_t restore_read(int dfd, const char *path)
+{
+	char buf[24];
+	ssize_t n;
+	int fd = openat(dfd, path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (n <= 0)
+		return -1;
+
+	buf[n] = '\0';
+	return restore_parse(buf, false);
+}
+
+/**
+ * restore_write:
+ * @dfd:	directory the path is relative to
+ * @path:	path of the value
+ * @val:	value to write
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool restore_write(int dfd, const char *path, int64_t val)
+{
+	char buf[24];
+	int len = sizeof(buf), fd;
+	bool r;
+
+	do {
+		buf[--len] = (char) ('0' + val % 10);
+		val /= 10;
+	} while (val > 0);
+
+	if ((fd = openat(dfd, path, O_WRONLY | O_CLOEXEC)) < 0)
+		return restore_err("can't open ", path);
+
+	r = write(fd, buf + len, sizeof(buf) - len) == (ssize_t) (sizeof(buf) - len);
+	close(fd);
+
+	return r ? true : restore_err("can't write ", path);
+}
+
+/**
+ * restore_auto:
+ * @dfd:	class directory
+ * @ctrl:	buffer of RESTORE_PATH_MAX bytes for the controller
+ *
+ * Picks the controller with the highest maximum, like the full program.
+ *
+ * Returns: true if one was found, false otherwise
+ **/
+static bool restore_auto(int dfd, char *ctrl)
+{
+	int64_t best = 0;
+	char path[RESTORE_PATH_MAX];
+	struct dirent *e;
+	DIR *dir = fdopendir(dup(dfd));
+
+	if (!dir)
+		return false;
+
+	while ((e = readdir(dir))) {
+		int64_t max;
+
+		if (e->d_name[0] == '.' ||
+		    !restore_cat(path, e->d_name, "/max_brightness", NULL) ||
+		    (max = restore_read(dfd, path)) <= best)
+			continue;
+
+		best = max;
+		restore_cat(ctrl, e->d_name, NULL);
+	}
+
+	closedir(dir);
+	return best > 0;
+}
+
+/**
+ * restore_cache:
+ * @path:	buffer of RESTORE_PATH_MAX bytes for the cache dir
+ *
+ * Returns: true on success, false if there is no cache dir
+ **/
+static bool restore_cache(char *path)
+{
+	const char *env;
+
+	if (geteuid() == 0)
+		return restore_cat(path, "/var/cache/" PROG, NULL);
+	if ((env = getenv("XDG_CACHE_HOME")))
+		return restore_cat(path, env, "/" PROG, NULL);
+	if ((env = getenv("HOME")))
+		return restore_cat(path, env, "/.cache/" PROG, NULL);
+
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	const char *tgt = "backlight", *value = NULL, *sysfs = getenv("BRILLO_SYSFS");
+	char ctrl[RESTORE_PATH_MAX] = "", path[RESTORE_PATH_MAX];
+	bool raw = false, restore = false;
+	int64_t max, val, mincap;
+	int sfd, cfd = -1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-k") == 0)
+			tgt = "leds";
+		else if (strcmp(argv[i], "-r") == 0)
+			raw = true;
+		else if (strcmp(argv[i], "-I") == 0)
+			restore = true;
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+			value = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc &&
+			 !strchr(argv[i + 1], '/') && restore_cat(ctrl, argv[i + 1], NULL))
+			i++;
+		else
+			return restore_exit(2, RESTORE_USAGE, NULL);
+	}
+
+	if (restore == !!value)
+		return restore_exit(2, RESTORE_USAGE, NULL);
+
+	if (!sysfs || geteuid() != getuid() || getegid() != getgid())
+		sysfs = "/sys";
+
+	if (!restore_cat(path, sysfs, "/class/", tgt, NULL) ||
+	    (sfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return restore_exit(EXIT_FAILURE, "can't open ", path);
+
+	if (!*ctrl && !restore_auto(sfd, ctrl))
+		return restore_exit(EXIT_FAILURE, "no controller in ", path);
+
+	if (!restore_cat(path, ctrl, "/max_brightness", NULL) || (max = restore_read(sfd, path)) <= 0)
+		return restore_exit(EXIT_FAILURE, "can't read ", path);
+
+	if (restore_cache(path))
+		cfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	/* cache files are "<target>.<controller>.<field>", no mincap means 1 */
+	if (cfd < 0 || !restore_cat(path, tgt, ".", ctrl, ".mincap", NULL) ||
+	    (mincap = restore_read(cfd, path)) < 0)
+		mincap = 1;
+
+	if (restore) {
+		if (cfd < 0 || !restore_cat(path, tgt, ".", ctrl, ".brightness", NULL) ||
+		    (val = restore_read(cfd, path)) < 0)
+			return restore_exit(EXIT_FAILURE, "nothing saved for ", ctrl);
+	} else if ((val = restore_parse(value, !raw)) < 0) {
+		return restore_exit(2, "value not recognizable: ", value);
+	} else if (!raw) {
+		val = val * max / RESTORE_PCT_MAX;
+	}
+
+	if (val < mincap)
+		val = mincap;
+	if (val > max)
+		val = max;
+
+	if (!restore_cat(path, ctrl, "/brightness", NULL) || !restore_write(sfd, path, val))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
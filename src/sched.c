@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "light.h"
+#include "value.h"
+#include "exec.h"
+#include "init.h"
+#include "sched.h"
+
+#define SCHED_POINTS_MAX 64
+#define SCHED_NSEC 1000000000LL
+
+/**
+ * sched_point:
+ *
+ * A point of the daily timeline: at sec seconds past local midnight,
+ * start moving towards value, arriving dur seconds later.
+ **/
+struct sched_point {
+	int64_t sec;
+	int64_t value;
+	int64_t dur;
+};
+
+/**
+ * sched_state:
+ *
+ * Where the timeline stands at a given time. While transitioning,
+ * the value moves linearly from `from` at `start` to `to` at `end`.
+ **/
+struct sched_state {
+	int64_t from;
+	int64_t to;
+	int64_t start;
+	int64_t end;
+	int64_t next;
+};
+
+static volatile sig_atomic_t sched_stop = 0;
+
+static void sched_signal(int sig)
+{
+	(void) sig;
+	sched_stop = 1;
+}
+
+/**
+ * sched_load:
+ * @conf:	configuration object holding the timeline path
+ * @points:	array to store the timeline in
+ *
+ * Loads a timeline of "HH:MM value seconds" lines, where value is
+ * given in the value mode of conf. Empty lines and lines starting
+ * with '#' are skipped. The points are sorted by time of day.
+ *
+ * Returns: number of points loaded, or -1 on failure
+ **/
+static int sched_load(struct light_conf *conf, struct sched_point *points)
+{
+	char line[256], val[64];
+	int n = 0, lineno = 0;
+	burn_file file = fopen(conf->file, "r");
+
+	if (!file) {
+		vlog_err("fopen '%s': %m", conf->file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		unsigned int hh, mm;
+		int64_t dur;
+		int i;
+		struct sched_point p;
+		char *s = line + strspn(line, " \t");
+
+		lineno++;
+		if (*s == '#' || *s == '\n' || *s == '\0')
+			continue;
+
+		if (sscanf(s, "%u:%u %63s %" SCNd64, &hh, &mm, val, &dur) != 4 ||
+		    hh > 23 || mm > 59 || dur < 0 ||
+		    (p.value = value_from_string(conf->val_mode, val)) < 0) {
+			vlog_err("%s:%d: expected 'HH:MM value seconds'", conf->file, lineno);
+			return -1;
+		}
+
+		if (n == SCHED_POINTS_MAX) {
+			vlog_err("%s: more than %d points", conf->file, SCHED_POINTS_MAX);
+			return -1;
+		}
+
+		p.sec = hh * 3600 + mm * 60;
+		p.dur = dur;
+
+		/* keep sorted, timelines are short */
+		for (i = n++; i > 0 && points[i - 1].sec > p.sec; i--)
+			points[i] = points[i - 1];
+		points[i] = p;
+	}
+
+	if (n == 0)
+		vlog_err("%s: empty timeline", conf->file);
+
+	return n > 0 ? n : -1;
+}
+
+/**
+ * sched_day:
+ * @now:	wall-clock time in seconds
+ * @offset:	days to add
+ *
+ * Returns: local midnight of the day of now plus offset days
+ **/
+static int64_t sched_day(time_t now, int offset)
+{
+	struct tm tm;
+
+	localtime_r(&now, &tm);
+	tm.tm_mday += offset;
+	tm.tm_hour = 0;
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+
+	return (int64_t) mktime(&tm);
+}
+
+/**
+ * sched_locate:
+ * @points:	timeline
+ * @n:		number of points
+ * @now:	wall-clock time in nanoseconds
+ * @st:		where to store the state
+ *
+ * Finds the last point that started before now, which defines
+ * the current transition, and the start of the point after it.
+ **/
+static void sched_locate(const struct sched_point *points, int n,
+			 int64_t now, struct sched_state *st)
+{
+	time_t sec = (time_t) (now / SCHED_NSEC);
+	int64_t today = sched_day(sec, 0), yesterday = sched_day(sec, -1);
+	int i;
+
+	/* latest point of today that already started, or yesterday's last */
+	for (i = n - 1; i >= 0 && (today + points[i].sec) * SCHED_NSEC > now; i--)
+		;
+
+	if (i >= 0)
+		st->start = (today + points[i].sec) * SCHED_NSEC;
+	else
+		st->start = (yesterday + points[(i = n - 1)].sec) * SCHED_NSEC;
+
+	st->to = points[i].value;
+	st->from = points[(i + n - 1) % n].value;
+	st->end = st->start + points[i].dur * SCHED_NSEC;
+
+	if (i + 1 < n && (today + points[i + 1].sec) * SCHED_NSEC > now)
+		st->next = (today + points[i + 1].sec) * SCHED_NSEC;
+	else
+		st->next = (sched_day(sec, 1) + points[0].sec) * SCHED_NSEC;
+}
+
+/**
+ * sched_value:
+ * @st:		current state
+ * @t:		wall-clock time in nanoseconds
+ *
+ * Returns: the value of the timeline at t
+ **/
+static int64_t sched_value(const struct sched_state *st, int64_t t)
+{
+	if (t >= st->end || st->end == st->start)
+		return st->to;
+	if (t <= st->start)
+		return st->from;
+
+	return st->from + (int64_t) ((double) (st->to - st->from) *
+				     (double) (t - st->start) / (double) (st->end - st->start));
+}
+
+/**
+ * sched_next_step:
+ * @mode:	value mode of the timeline
+ * @st:		current state
+ * @now:	wall-clock time in nanoseconds
+ * @max:	raw maximum of the controller
+ *
+ * Finds the first time after now at which the transition changes
+ * the raw value, so long transitions only wake up to write.
+ *
+ * Returns: wall-clock time of the next raw step in nanoseconds
+ **/
+static int64_t sched_next_step(LIGHT_VAL_MODE mode, const struct sched_state *st,
+			       int64_t now, int64_t max)
+{
+	int64_t lo = now, hi = st->end;
+	int64_t raw = value_to_raw(mode, sched_value(st, now), max);
+
+	if (value_to_raw(mode, sched_value(st, hi), max) == raw)
+		return hi;
+
+	/* the value is monotonic in time, so bisect down to a millisecond */
+	while (hi - lo > SCHED_NSEC / 1000) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if (value_to_raw(mode, sched_value(st, mid), max) == raw)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return hi;
+}
+
+/**
+ * sched_run:
+ * @conf:	configuration object to operate on
+ *
+ * Follows the daily timeline in conf->file until interrupted. The
+ * process sleeps on an absolute CLOCK_REALTIME timer that is cancelled
+ * when the clock is set, so clock changes and resume are picked up
+ * right away. During a transition it only wakes when the raw value
+ * of the controller changes.
+ *
+ * Returns: true when stopped by a signal, false on failure
+ **/
+bool sched_run(struct light_conf *conf)
+{
+	struct sched_point points[SCHED_POINTS_MAX];
+	struct sigaction sa = { .sa_handler = sched_signal };
+	int64_t max = VALUE_PCT_MAX, last = -1;
+	LIGHT_VAL_MODE val_mode = conf->val_mode;
+	int n;
+	burn_fd tfd = -1;
+
+	if ((n = sched_load(conf, points)) < 0)
+		return false;
+
+	/* with every controller selected, step on every value change */
+	if (conf->ctrl_mode != LIGHT_CTRL_ALL &&
+	    (!init_ctrl(conf) || (max = light_fetch(conf, LIGHT_MAX_BRIGHTNESS)) <= 0))
+		return false;
+	if (conf->ctrl_mode == LIGHT_CTRL_ALL)
+		val_mode = LIGHT_RAW;
+
+	if ((tfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC)) < 0) {
+		vlog_err("timerfd_create: %m");
+		return false;
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!sched_stop) {
+		struct timespec ts;
+		struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+		struct sched_state st;
+		int64_t now, wake, raw;
+		uint64_t expirations;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now = (int64_t) ts.tv_sec * SCHED_NSEC + ts.tv_nsec;
+
+		sched_locate(points, n, now, &st);
+		raw = value_to_raw(val_mode, sched_value(&st, now), max);
+		wake = now < st.end ? sched_next_step(val_mode, &st, now, max) : st.next;
+
+		if (raw != last) {
+			vlog_info("schedule: value %" PRId64, sched_value(&st, now));
+			if (!exec_apply(conf, LIGHT_SET, conf->val_mode,
+					sched_value(&st, now), conf->usec))
+				return false;
+			last = raw;
+		}
+
+		vlog_debug("schedule: sleeping for %" PRId64 " msecs", (wake - now) / 1000000);
+
+		its.it_value.tv_sec = (time_t) (wake / SCHED_NSEC);
+		its.it_value.tv_nsec = (long) (wake % SCHED_NSEC);
+
+		if (timerfd_settime(tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+			vlog_err("timerfd_settime: %m");
+			return false;
+		}
+
+		vlog_flush();
+		if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+			if (errno == ECANCELED)
+				vlog_notice("schedule: clock was set, resynchronizing");
+			else if (errno != EINTR) {
+				vlog_err("read timerfd: %m");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+
+#include "light.h"
+
+bool sched_run(struct light_conf *conf);
+
+#endif /* SCHED_H */
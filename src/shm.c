@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: 0BSD */
+
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "shm.h"
+
+#define SHM_TRIES 64
+#define SHM_NAME_MAX 32
+#define SHM_STALE_NSEC 1000000000LL	/* a writer holds a slot for microseconds */
+
+/*
+ * Every user publishes to a segment of their own, SHM_NAME.<uid>, so
+ * nobody can feed others values or end their dither hold. Readers
+ * take the newest of their own and root's segment, and ignore any
+ * segment owned by someone else or writable by others. Slots are
+ * seqlocks: a writer makes seq odd with a compare-and-swap, which
+ * also keeps other writers out, stores the fields and makes it even
+ * again. A reader copies the fields and retries if seq moved. After
+ * the segments are mapped, reading them costs no system calls.
+ */
+static struct shm_seg *shm_rd[2] = { NULL, NULL };	/* own, root's */
+static struct shm_seg *shm_wr = NULL;
+
+/**
+ * shm_now:
+ *
+ * Returns: monotonic time in nanoseconds
+ **/
+static int64_t shm_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * shm_map:
+ * @uid:	user whose segment to map
+ * @write:	whether to map the segment for writing, creating it
+ *
+ * Maps a segment once per process. It must belong to uid and must
+ * not be writable by anyone else.
+ *
+ * Returns: the segment, or NULL if it is not available
+ **/
+static struct shm_seg *shm_map(uid_t uid, bool write)
+{
+	struct shm_seg **seg = write ? &shm_wr : &shm_rd[uid != geteuid()];
+	char name[SHM_NAME_MAX];
+	struct stat st;
+	void *p;
+	burn_fd fd = -1;
+
+	if (*seg)
+		return *seg;
+
+	snprintf(name, sizeof(name), SHM_NAME ".%u", (unsigned) uid);
+	if ((fd = shm_open(name, write ? O_RDWR | O_CREAT : O_RDONLY,
+			   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0 ||
+	    fstat(fd, &st) < 0) {
+		vlog_debug("shm_open '%s': %m", name);
+		return NULL;
+	}
+
+	if (st.st_uid != uid || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		vlog_warning("ignoring '%s', it belongs to someone else", name);
+		return NULL;
+	}
+
+	if ((size_t) st.st_size < sizeof(struct shm_seg) &&
+	    (!write || ftruncate(fd, sizeof(struct shm_seg)) < 0)) {
+		vlog_debug("'%s' is too small", name);
+		return NULL;
+	}
+
+	p = mmap(NULL, sizeof(struct shm_seg), write ? PROT_READ | PROT_WRITE : PROT_READ,
+		 MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		vlog_debug("mmap '%s': %m", name);
+		return NULL;
+	}
+
+	*seg = p;
+
+	if (write && __atomic_load_n(&(*seg)->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+		(*seg)->slots = SHM_SLOTS;
+		__atomic_store_n(&(*seg)->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	return *seg;
+}
+
+/**
+ * shm_find:
+ * @seg:	mapped segment
+ * @key:	key of the slot
+ *
+ * Returns: the slot holding key, or NULL if there is none
+ **/
+static struct shm_slot *shm_find(struct shm_seg *seg, const char *key)
+{
+	for (int i = 0; i < SHM_SLOTS; i++) {
+		struct shm_slot *s = &seg->slot[i];
+
+		/* keys never change once the first write completed */
+		if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) >= 2 &&
+		    strncmp(s->key, key, SHM_KEY_MAX) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+/**
+ * shm_take:
+ * @s:		slot
+ * @now:	current monotonic time
+ * @fresh:	whether the slot may be one never claimed
+ *
+ * Makes seq odd for the caller. A slot left odd for SHM_STALE_NSEC
+ * belonged to a writer killed halfway, and is taken over.
+ *
+ * Returns: the odd seq now held, or 0 if the slot is busy
+ **/
+static uint32_t shm_take(struct shm_slot *s, int64_t now, bool fresh)
+{
+	uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+	uint32_t next;
+
+	if (seq == 0)
+		next = fresh ? 1 : 0;
+	else if (!(seq & 1))
+		next = fresh ? 0 : seq + 1;
+	else if (now - __atomic_load_n(&s->stamp_ns, __ATOMIC_RELAXED) > SHM_STALE_NSEC)
+		next = seq + 2;
+	else
+		next = 0;
+
+	if (next == 0 || !__atomic_compare_exchange_n(&s->seq, &seq, next, false,
+						       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+
+	/* at once, so the slot does not look stale while it is written */
+	__atomic_store_n(&s->stamp_ns, now, __ATOMIC_RELAXED);
+	if (seq & 1)
+		vlog_debug("taking over slot '%.*s' of a writer gone", SHM_KEY_MAX, s->key);
+	return next;
+}
+
+/**
+ * shm_publish:
+ * @key:	"<target>/<controller>", or "<target>" for the automatic one
+ * @from:	raw value the write starts at
+ * @to:		raw value the write ends at
+ * @max:	raw maximum, 0 if unknown
+ * @usec:	duration of the write
+ *
+ * Publishes the state of a controller for readers.
+ *
+ * Returns: true on success, false on failure
+ **/
+bool shm_publish(const char *key, int64_t from, int64_t to, int64_t max, int64_t usec)
+{
+	struct shm_seg *seg = shm_map(geteuid(), true);
+	struct shm_slot *s = NULL;
+	uint32_t seq = 0;
+	int64_t now = shm_now();
+
+	if (!seg || strlen(key) >= SHM_KEY_MAX)
+		return false;
+
+	/* take over the slot of key, or claim a fresh one */
+	for (int tries = 0; !s && tries < SHM_TRIES; tries++) {
+		struct shm_slot *found = shm_find(seg, key);
+
+		if (found) {
+			if ((seq = shm_take(found, now, false)))
+				s = found;
+			continue;
+		}
+
+		for (int i = 0; !s && i < SHM_SLOTS; i++) {
+			if ((seq = shm_take(&seg->slot[i], now, true))) {
+				s = &seg->slot[i];
+				strncpy(s->key, key, SHM_KEY_MAX);
+			}
+		}
+
+		if (!s) {
+			vlog_debug("shared memory has no free slot for '%s'", key);
+			return false;
+		}
+	}
+
+	if (!s)
+		return false;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s->from, from, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->to, to, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->max, max, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->start_ns, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->end_ns, now + usec * 1000, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->stamp_ns, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/**
+ * shm_snapshot:
+ * @seg:	mapped segment, or NULL
+ * @key:	key the state was published under
+ * @now:	current monotonic time
+ * @out:	where to store the state
+ *
+ * Returns: true if key was found in seg, false otherwise
+ **/
+static bool shm_snapshot(struct shm_seg *seg, const char *key, int64_t now,
+			 struct shm_value *out)
+{
+	struct shm_slot *s;
+	int64_t from;
+
+	if (!seg || __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+	    !(s = shm_find(seg, key)))
+		return false;
+
+	for (int tries = 0; ; tries++) {
+		uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+		if (tries == SHM_TRIES)
+			return false;
+		if (seq & 1)
+			continue;
+
+		from = __atomic_load_n(&s->from, __ATOMIC_RELAXED);
+		out->to = __atomic_load_n(&s->to, __ATOMIC_RELAXED);
+		out->max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+		out->start_ns = __atomic_load_n(&s->start_ns, __ATOMIC_RELAXED);
+		out->end_ns = __atomic_load_n(&s->end_ns, __ATOMIC_RELAXED);
+		out->age_ns = __atomic_load_n(&s->stamp_ns, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	out->age_ns = now - out->age_ns;
+
+	if (now >= out->end_ns)
+		out->cur = out->to;
+	else
+		out->cur = from + (out->to - from) * (now - out->start_ns) /
+			   (out->end_ns - out->start_ns);
+
+	return true;
+}
+
+/**
+ * shm_read:
+ * @key:	key the state was published under
+ * @max_age_ns:	oldest state to accept, unless a fade is still running
+ * @out:	where to store the state
+ *
+ * Reads the newest state of a controller that the caller or root
+ * published, without system calls once the segments are mapped.
+ *
+ * Returns: true if a fresh state was found, false otherwise
+ **/
+bool shm_read(const char *key, int64_t max_age_ns, struct shm_value *out)
+{
+	struct shm_value root;
+	int64_t now = shm_now();
+	bool found = shm_snapshot(shm_map(geteuid(), false), key, now, out);
+
+	if (geteuid() != 0 && shm_snapshot(shm_map(0, false), key, now, &root) &&
+	    (!found || root.start_ns > out->start_ns)) {
+		*out = root;
+		found = true;
+	}
+
+	return found && (now < out->end_ns || out->age_ns <= max_age_ns);
+}
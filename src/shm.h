@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: 0BSD */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SHM_NAME
+#define SHM_NAME "/brillo"
+#endif
+
+#define SHM_MAGIC 0x6f6c7262
+#define SHM_SLOTS 32
+#define SHM_KEY_MAX 56
+
+/**
+ * shm_slot:
+ *
+ * Published state of one controller, keyed "<target>/<controller>",
+ * or just "<target>" for the automatically chosen one. The value
+ * moves linearly from `from` at start_ns to `to` at end_ns, on
+ * CLOCK_MONOTONIC. Fields are guarded by seq, which is odd while
+ * a writer is busy and zero for a slot that was never claimed.
+ **/
+struct shm_slot {
+	uint32_t seq;
+	char key[SHM_KEY_MAX];
+	int64_t from;
+	int64_t to;
+	int64_t max;
+	int64_t start_ns;
+	int64_t end_ns;
+	int64_t stamp_ns;
+};
+
+struct shm_seg {
+	uint32_t magic;
+	uint32_t slots;
+	struct shm_slot slot[SHM_SLOTS];
+};
+
+/**
+ * shm_value:
+ *
+ * A consistent snapshot of a slot, with cur interpolated for now.
+ **/
+struct shm_value {
+	int64_t cur;
+	int64_t to;
+	int64_t max;
+	int64_t start_ns;
+	int64_t end_ns;
+	int64_t age_ns;
+};
+
+bool shm_publish(const char *key, int64_t from, int64_t to, int64_t max, int64_t usec);
+bool shm_read(const char *key, int64_t max_age_ns, struct shm_value *out);
+
+#endif /* SHM_H */
@@ -0,0 +1,614 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/thermal.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "cfg.h"
+#include "ctrl.h"
+#include "init.h"
+#include "light.h"
+#include "value.h"
+#include "file.h"
+#include "exec.h"
+#include "thermal.h"
+
+#define THERMAL_ZONES_MAX 16
+#define THERMAL_TRIPS_MAX 16
+#define THERMAL_CAP_DEFAULT "50"
+#define THERMAL_HYSTERESIS_DEFAULT 5000
+#define THERMAL_FADE_USEC 5000000
+#define THERMAL_RECHECK_MSEC 10000
+#define THERMAL_UEVENT_MAX 4096
+#define THERMAL_GENL_MAX 8192
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+/**
+ * thermal_zone:
+ *
+ * A watched thermal zone, which runs hot from hot millidegrees on
+ * and has cooled down below hot - hyst. Only its governor tells
+ * whether crossing a trip point sends a uevent.
+ **/
+struct thermal_zone {
+	char *temp;
+	int64_t hot;
+	int64_t hyst;
+	char policy[32];
+};
+
+static volatile sig_atomic_t thermal_stop = 0;
+
+static void thermal_signal(int sig)
+{
+	(void) sig;
+	thermal_stop = 1;
+}
+
+/**
+ * thermal_trip:
+ * @dir:	zone directory
+ * @zone:	zone to fill in
+ *
+ * Takes the lowest passive trip point of the zone, where the kernel
+ * would start throttling, as the temperature it runs hot at.
+ *
+ * Returns: true if the zone has a passive trip point, otherwise false
+ **/
+static bool thermal_trip(const char *dir, struct thermal_zone *zone)
+{
+	zone->hot = -1;
+
+	for (int i = 0; i < THERMAL_TRIPS_MAX; i++) {
+		char type[32];
+		int64_t temp, hyst;
+		burn_path p = path_new();
+
+		if (!p || !(p = path_append(p, "%s/trip_point_%d_type", dir, i)) ||
+		    file_read_str(p, type, sizeof(type)) < 0)
+			break;
+
+		if (strncmp(type, "passive", 7) != 0)
+			continue;
+
+		*p = '\0';
+		if (!(p = path_append(p, "%s/trip_point_%d_temp", dir, i)) ||
+		    (temp = file_read(p)) <= 0 || (zone->hot >= 0 && temp >= zone->hot))
+			continue;
+
+		*p = '\0';
+		if (!(p = path_append(p, "%s/trip_point_%d_hyst", dir, i)) ||
+		    (hyst = file_read(p)) <= 0)
+			hyst = THERMAL_HYSTERESIS_DEFAULT;
+
+		zone->hot = temp;
+		zone->hyst = hyst;
+	}
+
+	return zone->hot >= 0;
+}
+
+/**
+ * thermal_zones:
+ * @zones:	array of THERMAL_ZONES_MAX zones to fill in
+ *
+ * Finds the thermal zones to watch, those with a passive trip point,
+ * or every zone if the thermal.hot configuration key is set. The
+ * thermal.hysteresis key overrides the hysteresis of the trip points.
+ *
+ * Returns: the number of zones found
+ **/
+static int thermal_zones(struct thermal_zone *zones)
+{
+	int64_t hot = cfg_int("thermal.hot", 0) * 1000;
+	int64_t hyst = cfg_int("thermal.hysteresis", -1);
+	burn_path base = path_new();
+	burn_dir dir = NULL;
+	char *name;
+	int n = 0;
+
+	if (!base || !(base = path_append(base, "%s/class/thermal", path_sysfs())))
+		return 0;
+
+	if (!(dir = opendir(base))) {
+		vlog_err("opendir '%s': %m", base);
+		return 0;
+	}
+
+	while (n < THERMAL_ZONES_MAX && (name = ctrl_iter_next(dir))) {
+		struct thermal_zone *z = &zones[n];
+		burn_path zdir = path_new();
+		burn_path p = path_new();
+
+		if (strncmp(name, "thermal_zone", 12) != 0 || !zdir || !p ||
+		    !(zdir = path_append(zdir, "%s/%s", base, name)) ||
+		    !(hot > 0 || thermal_trip(zdir, z)) ||
+		    !(z->temp = path_new()) || !(z->temp = path_append(z->temp, "%s/temp", zdir))) {
+			path_free(name);
+			continue;
+		}
+
+		*p = '\0';
+		if (!(p = path_append(p, "%s/policy", zdir)) ||
+		    file_read_str(p, z->policy, sizeof(z->policy)) < 0)
+			z->policy[0] = '\0';
+		z->policy[strcspn(z->policy, "\n")] = '\0';
+
+		if (hot > 0) {
+			z->hot = hot;
+			z->hyst = THERMAL_HYSTERESIS_DEFAULT;
+		}
+		if (hyst >= 0)
+			z->hyst = hyst * 1000;
+
+		vlog_notice("watching '%s', hot from %" PRId64 " millidegrees", name, z->hot);
+		path_free(name);
+		n++;
+	}
+
+	if (n == 0)
+		vlog_err("no thermal zone with a passive trip point");
+
+	return n;
+}
+
+/**
+ * thermal_hot:
+ * @zones:	watched zones
+ * @n:		number of zones
+ * @capped:	whether the brightness is capped now
+ *
+ * Returns: true if the brightness should be capped, that is if any
+ *	    zone runs hot, or if it is capped and any zone did not yet
+ *	    cool down
+ **/
+static bool thermal_hot(const struct thermal_zone *zones, int n, bool capped)
+{
+	bool hot = false, cool = true;
+
+	for (const struct thermal_zone *z = zones; z < zones + n; z++) {
+		int64_t temp = file_read(z->temp);
+
+		if (temp < 0)
+			continue;
+
+		vlog_debug("'%s': %" PRId64 " millidegrees", z->temp, temp);
+		hot |= temp >= z->hot;
+		cool &= temp < z->hot - z->hyst;
+	}
+
+	return capped ? !cool : hot;
+}
+
+/**
+ * thermal_nla:
+ * @buf:	netlink attributes
+ * @len:	length of buf
+ * @type:	type of the attribute to find, or -1 for any
+ * @at:		offset to search from, moved past the attribute found
+ *
+ * Returns: the attribute, or NULL if there is none
+ **/
+static struct nlattr *thermal_nla(char *buf, int len, int type, int *at)
+{
+	while (*at + NLA_HDRLEN <= len) {
+		struct nlattr *a = (struct nlattr *) (buf + *at);
+
+		if (a->nla_len < NLA_HDRLEN || *at + a->nla_len > len)
+			return NULL;
+
+		*at += NLA_ALIGN(a->nla_len);
+		if (type < 0 || (a->nla_type & NLA_TYPE_MASK) == type)
+			return a;
+	}
+
+	return NULL;
+}
+
+/**
+ * thermal_genl_group:
+ * @fd:		generic netlink socket
+ *
+ * Asks the controller of generic netlink for the event group of the
+ * thermal family.
+ *
+ * Returns: the id of the group, or -1 if there is none
+ **/
+static int thermal_genl_group(int fd)
+{
+	struct {
+		struct nlmsghdr n;
+		struct genlmsghdr g;
+		struct nlattr a;
+		char name[NLA_ALIGN(sizeof(THERMAL_GENL_FAMILY_NAME))];
+	} req = {
+		.n = {
+			.nlmsg_len = sizeof(req),
+			.nlmsg_type = GENL_ID_CTRL,
+			.nlmsg_flags = NLM_F_REQUEST,
+			.nlmsg_seq = 1,
+		},
+		.g = { .cmd = CTRL_CMD_GETFAMILY, .version = 1 },
+		.a = {
+			.nla_len = NLA_HDRLEN + sizeof(THERMAL_GENL_FAMILY_NAME),
+			.nla_type = CTRL_ATTR_FAMILY_NAME,
+		},
+		.name = THERMAL_GENL_FAMILY_NAME,
+	};
+	union {
+		struct nlmsghdr n;
+		char buf[THERMAL_GENL_MAX];
+	} reply;
+	struct nlattr *groups, *g;
+	char *attrs;
+	ssize_t len;
+	int at = 0, gat = 0, alen;
+
+	if (send(fd, &req, sizeof(req), 0) < 0 ||
+	    (len = recv(fd, &reply, sizeof(reply), 0)) < 0) {
+		vlog_info("thermal netlink: %m");
+		return -1;
+	}
+
+	if (!NLMSG_OK(&reply.n, len) || reply.n.nlmsg_type == NLMSG_ERROR ||
+	    reply.n.nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+		vlog_info("thermal netlink: no thermal family");
+		return -1;
+	}
+
+	attrs = (char *) NLMSG_DATA(&reply.n) + GENL_HDRLEN;
+	alen = (int) (reply.n.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+
+	if (!(groups = thermal_nla(attrs, alen, CTRL_ATTR_MCAST_GROUPS, &at)))
+		return -1;
+
+	/* a nest of groups, each a nest of a name and an id */
+	while ((g = thermal_nla((char *) groups + NLA_HDRLEN, groups->nla_len - NLA_HDRLEN,
+				-1, &gat))) {
+		int nat = 0, iat = 0;
+		int glen = g->nla_len - NLA_HDRLEN;
+		struct nlattr *name = thermal_nla((char *) g + NLA_HDRLEN, glen,
+						  CTRL_ATTR_MCAST_GRP_NAME, &nat);
+		struct nlattr *id = thermal_nla((char *) g + NLA_HDRLEN, glen,
+						CTRL_ATTR_MCAST_GRP_ID, &iat);
+		uint32_t val;
+
+		if (!name || !id || id->nla_len < NLA_HDRLEN + sizeof(val) ||
+		    strncmp((char *) name + NLA_HDRLEN, THERMAL_GENL_EVENT_GROUP_NAME,
+			    name->nla_len - NLA_HDRLEN) != 0)
+			continue;
+
+		memcpy(&val, (char *) id + NLA_HDRLEN, sizeof(val));
+		return (int) val;
+	}
+
+	return -1;
+}
+
+/**
+ * thermal_genl:
+ *
+ * Opens a socket on the event group of the thermal generic netlink
+ * family, which reports trip points being crossed whatever governor
+ * a zone uses.
+ *
+ * Returns: the socket, or -1 if the kernel offers no such group
+ **/
+static int thermal_genl(void)
+{
+	struct sockaddr_nl nl = { .nl_family = AF_NETLINK };
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	int group;
+
+	if (fd < 0 || bind(fd, (struct sockaddr *) &nl, sizeof(nl)) < 0 ||
+	    (group = thermal_genl_group(fd)) < 0 ||
+	    setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0 ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	vlog_notice("listening to thermal netlink events");
+	return fd;
+}
+
+/**
+ * thermal_uevent:
+ *
+ * Opens the socket the uevents of the kernel arrive on, or a unix
+ * datagram socket bound at BRILLO_UEVENT to stand in for it.
+ *
+ * Returns: the socket, or -1 on failure
+ **/
+static int thermal_uevent(void)
+{
+	const char *path = path_uevent();
+	struct sockaddr_nl nl = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+	struct sockaddr_un un = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (path && strlen(path) >= sizeof(un.sun_path)) {
+		vlog_err("socket path too long: '%s'", path);
+		return -1;
+	}
+
+	fd = path ? socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) :
+		    socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			   NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		vlog_err("socket: %m");
+		return -1;
+	}
+
+	if (path) {
+		strcpy(un.sun_path, path);
+		unlink(path);
+	}
+
+	if ((path ? bind(fd, (struct sockaddr *) &un, sizeof(un)) :
+		    bind(fd, (struct sockaddr *) &nl, sizeof(nl))) < 0) {
+		vlog_err("bind: %m");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * thermal_socket:
+ * @zones:	watched zones
+ * @n:		number of zones
+ * @genl:	where to store whether the socket is a thermal netlink one
+ * @idle:	where to store how long to wait while not capped, in msec
+ *
+ * Listens to thermal netlink events, or else to uevents. Zones whose
+ * governor is not user_space send no uevent when crossing a trip
+ * point, so they are checked every few seconds then.
+ *
+ * Returns: the socket, or -1 on failure
+ **/
+static int thermal_socket(const struct thermal_zone *zones, int n, bool *genl, int *idle)
+{
+	int fd = -1;
+
+	*idle = -1;
+
+	/* the stand-in for tests only sends uevents */
+	if ((*genl = !path_uevent() && (fd = thermal_genl()) >= 0))
+		return fd;
+
+	for (int i = 0; i < n; i++) {
+		if (strcmp(zones[i].policy, "user_space") != 0) {
+			vlog_warning("'%s' sends no uevents with the '%s' governor, "
+				     "checking every %d seconds", zones[i].temp,
+				     zones[i].policy, THERMAL_RECHECK_MSEC / 1000);
+			*idle = THERMAL_RECHECK_MSEC;
+			break;
+		}
+	}
+
+	return thermal_uevent();
+}
+
+/**
+ * thermal_event:
+ * @fd:		socket to drain
+ * @genl:	whether fd is a thermal netlink socket
+ *
+ * Returns: true if a trip point was crossed, as told by a thermal
+ *	    netlink event or by a uevent of the thermal subsystem,
+ *	    otherwise false
+ **/
+static bool thermal_event(int fd, bool genl)
+{
+	union {
+		struct nlmsghdr n;
+		char buf[THERMAL_GENL_MAX];
+	} msg;
+	ssize_t len;
+	bool found = false;
+
+	while ((len = recv(fd, msg.buf, sizeof(msg.buf) - 1, 0)) > 0) {
+		msg.buf[len] = '\0';
+
+		if (genl) {
+			int left = (int) len;
+
+			for (struct nlmsghdr *n = &msg.n; NLMSG_OK(n, left); n = NLMSG_NEXT(n, left)) {
+				struct genlmsghdr *g = NLMSG_DATA(n);
+
+				if (n->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN) &&
+				    (g->cmd == THERMAL_GENL_EVENT_TZ_TRIP_UP ||
+				     g->cmd == THERMAL_GENL_EVENT_TZ_TRIP_DOWN)) {
+					vlog_debug("thermal netlink event %d", g->cmd);
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		/* "action@devpath" followed by NUL separated KEY=value pairs */
+		for (char *s = msg.buf; s < msg.buf + len; s += strlen(s) + 1) {
+			if (strcmp(s, "SUBSYSTEM=thermal") == 0) {
+				vlog_debug("uevent '%s'", msg.buf);
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+/**
+ * thermal_cap:
+ * @conf:	configuration object of the controller
+ * @cap:	raw maximum to hold the brightness at, or -1 to lift it
+ *
+ * Stores the maximum cap that every write of the brightness obeys,
+ * whoever makes it, or removes it. The cap is replaced at once, so
+ * a writer never reads half of it.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool thermal_cap(struct light_conf *conf, int64_t cap)
+{
+	char buf[24];
+	int len = snprintf(buf, sizeof(buf), "%" PRId64 "\n", cap);
+	burn_path path = init_run(conf, cap >= 0) ? light_path_new(conf, LIGHT_MAX_CAP) : NULL;
+	burn_path tmp = NULL;
+	burn_fd fd = -1;
+
+	if (!path)
+		return cap < 0;
+
+	if (cap < 0)
+		return unlink(path) == 0 || errno == ENOENT;
+
+	if (!(tmp = path_new()) || !(tmp = path_append(tmp, "%s.%ld", path, (long) getpid())) ||
+	    (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644)) < 0 ||
+	    write(fd, buf, (size_t) len) != len || rename(tmp, path) < 0) {
+		vlog_err("storing the cap in '%s': %m", path);
+		if (tmp)
+			unlink(tmp);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * thermal_apply:
+ * @conf:	configuration object of the controller
+ * @capped:	whether to cap the brightness
+ * @wanted:	brightness from before the cap, updated
+ *
+ * Caps the brightness at thermal.cap percent, fading it down if it
+ * is above, or lifts the cap and fades back to the brightness from
+ * before, unless it was changed in between.
+ *
+ * Returns: true on success, false on failure
+ **/
+static bool thermal_apply(struct light_conf *conf, bool capped, int64_t *wanted)
+{
+	const char *pct = cfg_get("thermal.cap");
+	int64_t max = light_fetch(conf, LIGHT_MAX_BRIGHTNESS);
+	int64_t cur = light_fetch(conf, LIGHT_BRIGHTNESS);
+	int64_t cap = value_from_string(LIGHT_PERCENT, pct ? pct : THERMAL_CAP_DEFAULT);
+
+	if (max <= 0 || cur < 0 || cap < 0) {
+		vlog_err("reading '%s': %s", conf->ctrl, cap < 0 ? "invalid thermal.cap" : "failed");
+		return false;
+	}
+
+	cap = value_to_raw(LIGHT_PERCENT, VALUE_CLAMP_PCT(cap), max);
+
+	if (!capped) {
+		vlog_notice("cooled down, lifting the cap of '%s'", conf->ctrl);
+		if (!thermal_cap(conf, -1))
+			return false;
+		if (*wanted > cur && cur == cap &&
+		    !exec_apply(conf, LIGHT_SET, LIGHT_RAW, *wanted, conf->usec))
+			return false;
+		*wanted = -1;
+		return true;
+	}
+
+	vlog_notice("running hot, capping '%s' at %" PRId64, conf->ctrl, cap);
+	if (!thermal_cap(conf, cap))
+		return false;
+
+	if (cur <= cap)
+		return true;
+
+	*wanted = cur;
+	return exec_apply(conf, LIGHT_SET, LIGHT_RAW, cap, conf->usec);
+}
+
+/**
+ * thermal_run:
+ * @conf:	configuration object to operate on
+ *
+ * Caps the brightness while the device runs hot, until interrupted.
+ * The temperatures are checked when a thermal zone reports crossing
+ * a trip point, and every few seconds while capped, as cooling down
+ * past the hysteresis comes without a report.
+ *
+ * Returns: true when stopped by a signal, false on failure
+ **/
+bool thermal_run(struct light_conf *conf)
+{
+	struct thermal_zone zones[THERMAL_ZONES_MAX];
+	struct sigaction sa = { .sa_handler = thermal_signal };
+	int64_t wanted = -1;
+	bool capped = false, genl, ret = true;
+	burn_fd fd = -1;
+	int n, idle;
+
+	if (!init_ctrl(conf) || (n = thermal_zones(zones)) == 0)
+		return false;
+
+	if ((fd = thermal_socket(zones, n, &genl, &idle)) < 0) {
+		while (n--)
+			path_free(zones[n].temp);
+		return false;
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (conf->usec == 0)
+		conf->usec = THERMAL_FADE_USEC;
+
+	/* a cap left behind by a crash would hold the brightness for good */
+	thermal_cap(conf, -1);
+
+	for (bool check = true; !thermal_stop; ) {
+		int r;
+
+		if (check && thermal_hot(zones, n, capped) != capped) {
+			capped = !capped;
+			if (!thermal_apply(conf, capped, &wanted)) {
+				ret = false;
+				break;
+			}
+		}
+
+		vlog_flush();
+
+		r = poll(&(struct pollfd) { .fd = fd, .events = POLLIN }, 1,
+			 capped ? THERMAL_RECHECK_MSEC : idle);
+		if (r < 0 && errno != EINTR) {
+			vlog_err("poll: %m");
+			ret = false;
+			break;
+		}
+
+		check = r == 0 || (r > 0 && thermal_event(fd, genl));
+	}
+
+	thermal_cap(conf, -1);
+	if (path_uevent())
+		unlink(path_uevent());
+
+	while (n--)
+		path_free(zones[n].temp);
+
+	return ret;
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <stdbool.h>
+
+#include "light.h"
+
+bool thermal_run(struct light_conf *conf);
+
+#endif /* THERMAL_H */
@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#include "burno.h"
+#include "vlog.h"
+#include "path.h"
+#include "cfg.h"
+#include "init.h"
+#include "value.h"
+#include "usage.h"
+
+#define USAGE_MAX_DEFAULT (1024 * 1024)
+#define USAGE_BUCKETS 11
+#define USAGE_KEYS 32
+
+/*
+ * Every effective change appends one record to usage.log in the cache
+ * dir, with a single write() to an O_APPEND descriptor, so concurrent
+ * writers never interleave. Once the next record would take the log
+ * past usage.max bytes, it is renamed to usage.log.1, replacing the
+ * previous one. The report maps both logs and walks them in place.
+ */
+
+/**
+ * usage_key:
+ *
+ * Report state of one controller: how long it sat in each bucket of
+ * 10%, the last one being 100%, and the bucket it is in since since_ns.
+ **/
+struct usage_key {
+	uint8_t target;
+	char ctrl[USAGE_CTRL_MAX];
+	int bucket;
+	int64_t since_ns;
+	int64_t ns[USAGE_BUCKETS];
+};
+
+/**
+ * usage_path:
+ * @conf:	configuration object
+ * @create:	whether the cache dir has to exist
+ * @suffix:	suffix of the log name
+ *
+ * WARNING: this function allocates memory, but does not free it.
+ *
+ * Returns: the path of the log, or NULL on failure
+ **/
+static char *usage_path(struct light_conf *conf, bool create, const char *suffix)
+{
+	const char *prefix = init_cache(conf, create);
+	const char *slash;
+	char *p;
+
+	/* the prefix is the dir followed by the target */
+	if (!prefix || !(slash = strrchr(prefix, '/')) || !(p = path_new()))
+		return NULL;
+
+	return path_append(p, "%.*s/usage.log%s", (int) (slash - prefix), prefix, suffix);
+}
+
+/**
+ * usage_log:
+ * @conf:	configuration object of the controller
+ * @from:	raw value before the change
+ * @to:		raw value after the change
+ * @max:	maximum raw value
+ * @usec:	duration of the change
+ *
+ * Appends a record of the change to the usage log, unless the
+ * usage.max configuration key is 0. Failing to is harmless.
+ **/
+void usage_log(struct light_conf *conf, int64_t from, int64_t to, int64_t max, int64_t usec)
+{
+	struct usage_rec rec = {
+		.magic = USAGE_MAGIC,
+		.target = (uint8_t) conf->target,
+		.op = (uint8_t) conf->op_mode,
+		.from = from,
+		.to = to,
+		.max = max,
+		.usec = usec,
+	};
+	int64_t limit = cfg_int("usage.max", USAGE_MAX_DEFAULT);
+	int flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+	struct timespec ts;
+	struct stat st, cur;
+	burn_path path = NULL;
+	burn_path old = NULL;
+	burn_fd fd = -1;
+
+	if (limit <= 0 || from == to)
+		return;
+
+	if (!(path = usage_path(conf, true, "")) || (fd = open(path, flags, 0644)) < 0 ||
+	    fstat(fd, &st) < 0) {
+		vlog_info("usage log: %m");
+		return;
+	}
+
+	/* rotate, unless another writer just did */
+	if (st.st_size > 0 && st.st_size + (off_t) sizeof(rec) > limit) {
+		if ((old = usage_path(conf, false, ".1")) && stat(path, &cur) == 0 &&
+		    cur.st_ino == st.st_ino && cur.st_dev == st.st_dev && rename(path, old) < 0)
+			vlog_info("usage log rotation: %m");
+		close(fd);
+		if ((fd = open(path, flags, 0644)) < 0) {
+			vlog_info("usage log: %m");
+			return;
+		}
+	}
+
+	strncpy(rec.ctrl, conf->ctrl, sizeof(rec.ctrl));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec.time_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	if (write(fd, &rec, sizeof(rec)) != (ssize_t) sizeof(rec))
+		vlog_info("usage log: short write");
+}
+
+/**
+ * usage_walk:
+ * @keys:	controllers seen so far
+ * @n:		number of them, updated
+ * @recs:	records to account for
+ * @count:	number of records
+ *
+ * Adds the time since the previous change of each controller to
+ * the bucket it was left in. Time going backwards is skipped.
+ **/
+static void usage_walk(struct usage_key *keys, int *n,
+		       const struct usage_rec *recs, size_t count)
+{
+	struct usage_key *k = NULL;
+
+	for (const struct usage_rec *r = recs; r < recs + count; r++) {
+		int64_t pct;
+
+		if (r->magic != USAGE_MAGIC || r->max <= 0)
+			continue;
+
+		/* changes mostly come in runs on the same controller */
+		if (!k || k->target != r->target || memcmp(k->ctrl, r->ctrl, sizeof(k->ctrl)) != 0) {
+			for (k = keys; k < keys + *n; k++) {
+				if (k->target == r->target &&
+				    memcmp(k->ctrl, r->ctrl, sizeof(k->ctrl)) == 0)
+					break;
+			}
+			if (k == keys + *n) {
+				if (*n == USAGE_KEYS) {
+					k = NULL;
+					continue;
+				}
+				memset(k, 0, sizeof(*k));
+				k->target = r->target;
+				memcpy(k->ctrl, r->ctrl, sizeof(k->ctrl));
+				(*n)++;
+			}
+		}
+
+		if (k->since_ns > 0 && r->time_ns > k->since_ns)
+			k->ns[k->bucket] += r->time_ns - k->since_ns;
+
+		pct = value_clamp(r->to, 0, r->max) * 100 / r->max;
+		k->bucket = (int) (pct / 10);
+		k->since_ns = r->time_ns;
+	}
+}
+
+/**
+ * usage_map:
+ * @path:	path of a log
+ * @len:	where to store the length of the mapping
+ *
+ * Returns: the mapped records, or NULL if there are none
+ **/
+static const struct usage_rec *usage_map(const char *path, size_t *len)
+{
+	struct stat st;
+	void *p;
+	burn_fd fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct usage_rec))
+		return NULL;
+
+	if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		vlog_err("mmap: %m");
+		return NULL;
+	}
+
+	posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+	*len = st.st_size;
+
+	return p;
+}
+
+/**
+ * usage_report:
+ * @conf:	configuration object
+ *
+ * Prints how many seconds each controller spent in each 10% of
+ * its range, from the usage logs, as tab separated lines of the
+ * controller, the lower end of the range and the seconds. The
+ * last change of each controller counts until now.
+ *
+ * Returns: true on success, false if nothing was logged
+ **/
+bool usage_report(struct light_conf *conf)
+{
+	static const char *targets[] = { "", "backlight", "leds" };
+	struct usage_key keys[USAGE_KEYS];
+	const char *suffixes[] = { ".1", "" };
+	struct timespec ts;
+	int64_t now;
+	int n = 0;
+	bool found = false;
+
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		burn_path path = usage_path(conf, false, suffixes[i]);
+		const struct usage_rec *recs;
+		size_t len;
+
+		if (!path || !(recs = usage_map(path, &len)))
+			continue;
+
+		usage_walk(keys, &n, recs, len / sizeof(*recs));
+		munmap((void *) recs, len);
+		found = true;
+	}
+
+	if (!found) {
+		vlog_err("no usage logged");
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	for (struct usage_key *k = keys; k < keys + n; k++) {
+		if (now > k->since_ns)
+			k->ns[k->bucket] += now - k->since_ns;
+
+		for (int b = 0; b < USAGE_BUCKETS; b++) {
+			if (k->ns[b] > 0)
+				printf("%s/%.*s\t%d\t%.1f\n",
+				       k->target < 3 ? targets[k->target] : "?",
+				       USAGE_CTRL_MAX, k->ctrl, b * 10, (double) k->ns[b] / 1e9);
+		}
+	}
+
+	return true;
+}
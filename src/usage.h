@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "light.h"
+
+#define USAGE_MAGIC 0x31557242
+#define USAGE_CTRL_MAX 32
+
+/**
+ * usage_rec:
+ *
+ * One effective brightness change, as appended to the usage log.
+ * The value moved from `from` to `to` out of `max` raw levels over
+ * usec, starting at time_ns on CLOCK_REALTIME. The controller name
+ * is truncated to USAGE_CTRL_MAX bytes and only NUL-terminated when
+ * it is shorter. Records are 80 bytes in native byte order.
+ **/
+struct usage_rec {
+	uint32_t magic;
+	uint8_t target;
+	uint8_t op;
+	uint16_t reserved;
+	int64_t time_ns;
+	int64_t from;
+	int64_t to;
+	int64_t max;
+	int64_t usec;
+	char ctrl[USAGE_CTRL_MAX];
+};
+
+void usage_log(struct light_conf *conf, int64_t from, int64_t to, int64_t max, int64_t usec);
+bool usage_report(struct light_conf *conf);
+
+#endif /* USAGE_H */
@@ -107,6 +107,27 @@ int64_t value_to_raw(LIGHT_VAL_MODE mode, int64_t val, int64_t max)
 	}
 }
 
+/**
+ * value_to_raw_fine:
+ * @mode:	value mode used to calculate raw value
+ * @val:	value to convert to raw value
+ * @max:	raw maximum value to use
+ *
+ * Calculates a raw value like value_to_raw(), but keeps the part
+ * between two raw levels, for dithering.
+ *
+ * Returns: the fractional raw value
+ **/
+double value_to_raw_fine(LIGHT_VAL_MODE mode, int64_t val, int64_t max)
+{
+	if (mode == LIGHT_PERCENT)
+		return (double) val * (double) max / VALUE_PCT_MAX;
+	else if (mode == LIGHT_PERCENT_EXPONENTIAL)
+		return exp((double) val * log((double) max) / VALUE_PCT_MAX);
+	else
+		return (double) value_to_raw(mode, val, max);
+}
+
 /**
  * value_from_string:
  * @mode:	mode to use to convert value
@@ -1,23 +1,120 @@
 /* SPDX-License-Identifier: 0BSD */
 
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "vlog.h"
 
+#define VLOG_LINE_MAX 512
+
 static vlog_lvl_t vlog_lvl = VLOG_LVL_DEFAULT;
 static const char *vlog_lvl_to_string(vlog_lvl_t lvl);
 
+/*
+ * Messages are kept in a ring and written out in one go at exit,
+ * on errors and when vlog_flush() is called. Once the ring is full,
+ * the oldest messages are overwritten. head and tail count every
+ * byte ever logged and flushed, the ring index is their remainder.
+ */
+static char vlog_ring[VLOG_RING_SIZE];
+static size_t vlog_head = 0;
+static size_t vlog_tail = 0;
+static bool vlog_atexit = false;
+static bool vlog_to_syslog = false;
+
 void vlog(vlog_lvl_t lvl, const char *fmt, ...)
 {
+	char line[VLOG_LINE_MAX];
+	int errsv = errno, len = 0, r;
+	va_list ap;
+
 	if (lvl > vlog_lvl)
 		return;
-	fprintf(stderr, "%s: ", vlog_lvl_to_string(lvl));
-	va_list ap;
+
+	if (!vlog_to_syslog)
+		len = snprintf(line, sizeof(line), "%s: ", vlog_lvl_to_string(lvl));
+
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
+	errno = errsv;
+	r = vsnprintf(line + len, sizeof(line) - len, fmt, ap);
 	va_end(ap);
-	fprintf(stderr, "\n");
+
+	if (r < 0)
+		r = 0;
+	if ((size_t) (len + r) >= sizeof(line) - 1) {
+		len = sizeof(line) - 2;
+		memcpy(line + len - 3, "...", 3);
+	} else {
+		len += r;
+	}
+
+	if (vlog_to_syslog) {
+		syslog((int) lvl, "%.*s", len, line);
+		errno = errsv;
+		return;
+	}
+
+	line[len++] = '\n';
+
+	for (int i = 0; i < len; i++)
+		vlog_ring[vlog_head++ % VLOG_RING_SIZE] = line[i];
+
+	if (!vlog_atexit)
+		vlog_atexit = atexit(vlog_flush) == 0;
+
+	if (lvl <= VLOG_LVL_ERROR)
+		vlog_flush();
+
+	errno = errsv;
+}
+
+void vlog_flush(void)
+{
+	static const char dropped[] = "Warning: earlier messages were dropped\n";
+	struct iovec iov[3];
+	size_t start, end;
+	int n = 0;
+
+	if (vlog_head == vlog_tail)
+		return;
+
+	/* skip the partly overwritten message */
+	if (vlog_head - vlog_tail > VLOG_RING_SIZE) {
+		vlog_tail = vlog_head - VLOG_RING_SIZE;
+		while (vlog_tail < vlog_head && vlog_ring[vlog_tail++ % VLOG_RING_SIZE] != '\n')
+			;
+		iov[n++] = (struct iovec) { (void *) dropped, sizeof(dropped) - 1 };
+	}
+
+	start = vlog_tail % VLOG_RING_SIZE;
+	end = vlog_head % VLOG_RING_SIZE;
+
+	if (vlog_head - vlog_tail == VLOG_RING_SIZE || end < start) {
+		iov[n++] = (struct iovec) { vlog_ring + start, VLOG_RING_SIZE - start };
+		iov[n++] = (struct iovec) { vlog_ring, end };
+	} else {
+		iov[n++] = (struct iovec) { vlog_ring + start, end - start };
+	}
+
+	vlog_tail = vlog_head;
+
+	/* nowhere left to report a failure to */
+	if (writev(STDERR_FILENO, iov, n) < 0)
+		return;
+}
+
+void vlog_syslog(const char *ident)
+{
+	vlog_flush();
+	openlog(ident, LOG_PID, LOG_USER);
+	vlog_to_syslog = true;
 }
 
 vlog_lvl_t vlog_lvl_set(vlog_lvl_t lvl)
@@ -3,6 +3,7 @@
 #ifndef VLOG_H
 #define VLOG_H
 
+/* levels match the syslog(3) priorities */
 typedef enum {
 	VLOG_LVL_EMERGENCY = 0,
 	VLOG_LVL_ALERT,
@@ -14,11 +15,17 @@ typedef enum {
 	VLOG_LVL_DEBUG
 } vlog_lvl_t;
 
+#ifndef VLOG_RING_SIZE
+#define VLOG_RING_SIZE 16384
+#endif
+
 #ifndef VLOG_LVL_DEFAULT
 #define VLOG_LVL_DEFAULT VLOG_LVL_WARNING
 #endif
 
 void vlog(vlog_lvl_t lvl, const char* fmt, ...);
+void vlog_flush(void);
+void vlog_syslog(const char *ident);
 
 #define vlog_emerg(...) vlog(VLOG_LVL_EMERGENCY, __VA_ARGS__)
 #define vlog_alert(...) vlog(VLOG_LVL_ALERT, __VA_ARGS__)
@@ -35,4 +35,443 @@ test ! -d /sys/class/leds || {
 	_ckvg "opmode=list target=keyboard" -Lk
 }
 
+# fake sysfs tree, see BRILLO_SYSFS
+sys="$(mktemp -d)"
+mocks=""
+trap 'test -z "${mocks}" || kill ${mocks}; rm -rf "${sys}"' EXIT
+export BRILLO_SYSFS="${sys}" XDG_CACHE_HOME="${sys}/cache"
+
+_fake() {
+	local path="${sys}/$1"
+
+	mkdir -p "${path%/*}"
+	printf '%s\n' "$2" > "${path}"
+}
+
+_ckval() {
+	local id="$1"
+	local got="$(cat "${sys}/$2")"
+
+	test "${got}" = "$3" || {
+		printf 'Unexpected value for test: %s\n' "${id}"
+		printf '%s: got %s, expected %s\n' "$2" "${got}" "$3"
+		ret=1
+	}
+}
+
+_fake class/backlight/fake/max_brightness 1000
+_fake class/backlight/fake/brightness 1000
+_fake bus/iio/devices/iio:device0/in_illuminance_input 5
+
+valgrind="${BRILLO_VALGRIND}"
+BRILLO_VALGRIND="timeout -s INT 5 ${valgrind}"
+_ckvg "opmode=ambient" -X
+BRILLO_VALGRIND="${valgrind}"
+_ckval "opmode=ambient" class/backlight/fake/brightness 194
+
+# the same sensor read from its triggered buffer, a FIFO standing in
+# for the character device, see BRILLO_DEV; 50 lux as a 16 bit sample
+iio=bus/iio/devices/iio:device0
+_fake "${iio}/trigger/current_trigger" trig0
+_fake "${iio}/scan_elements/in_illuminance_type" "le:u16/16>>0"
+_fake "${iio}/scan_elements/in_illuminance_en" 0
+_fake "${iio}/buffer/enable" 0
+mkdir -p "${sys}/dev"
+mkfifo "${sys}/dev/iio:device0"
+exec 8<>"${sys}/dev/iio:device0"
+printf '\062\000' >&8
+export BRILLO_DEV="${sys}/dev"
+BRILLO_VALGRIND="timeout -s INT 2 ${valgrind}"
+_ckvg "opmode=ambient buffer" -s fake -X
+BRILLO_VALGRIND="${valgrind}"
+unset BRILLO_DEV
+exec 8>&-
+_ckval "opmode=ambient buffer" class/backlight/fake/brightness 426
+_ckval "opmode=ambient buffer" "${iio}/buffer/enable" 0
+rm -r "${sys}/${iio}/trigger"
+
+# a single point of the timeline has always passed, today or yesterday
+printf '# HH:MM value seconds\n00:00 37 60\n' > "${sys}/timeline"
+BRILLO_VALGRIND="timeout -s INT 2 ${valgrind}"
+_ckvg "opmode=schedule" -s fake -T "${sys}/timeline"
+BRILLO_VALGRIND="${valgrind}"
+_ckval "opmode=schedule" class/backlight/fake/brightness 370
+
+_ckvg "opmode=report" -R
+"${BRILLO_BIN}" -R | grep -q "^backlight/fake	10	" || {
+	printf 'Missing time at level for test: opmode=report\n'
+	ret=1
+}
+
+_allocs() {
+	${BRILLO_VALGRIND} "$BRILLO_BIN" "$@" 2>&1 |
+		sed -n 's/.*total heap usage: \([0-9,]*\) allocs.*/\1/p' | tr -d ,
+}
+
+# past parsing the arguments, get and set allocate nothing: what is
+# left is the conf object, the -s string and the stdout buffer of -G,
+# also when the controller is picked or a fade reads the power supply
+_fake class/power_supply/AC/type Mains
+_fake class/power_supply/AC/online 1
+"${BRILLO_BIN}" -G >/dev/null
+while read -r expect op; do
+	n="$(_allocs ${op})"
+	test -n "${n}" && test "${n}" -eq "${expect}" || {
+		printf 'Allocated %s times, expected %s for test: allocs %s\n' \
+			"${n:-unknown}" "${expect}" "${op}"
+		ret=1
+	}
+done <<EOF
+3 -s fake -G
+2 -s fake -S 40
+2 -s fake -A 5
+2 -s fake -U 5
+2 -s fake -u 100000 -S 45
+2 -G
+1 -S 35
+1 -u 100000 -A 5
+EOF
+_fake class/backlight/fake/brightness 400
+
+# every user publishes to a segment of their own
+test ! -d /dev/shm || test -O "/dev/shm/brillo.$(id -u)" || {
+	printf 'Missing own segment for test: shm\n'
+	ret=1
+}
+
+# a slot left odd by a writer killed halfway is taken over
+! command -v python3 >/dev/null || test ! -d /dev/shm || {
+	python3 -c 'import mmap, struct, sys
+f = open(sys.argv[1], "r+b")
+m = mmap.mmap(f.fileno(), 0)
+for at in range(8, len(m) - 111, 112):
+    if m[at + 4:at + 60].rstrip(b"\0") == b"backlight/fake":
+        struct.pack_into("<I", m, at, struct.unpack_from("<I", m, at)[0] | 1)
+        struct.pack_into("<q", m, at + 104, 1)' "/dev/shm/brillo.$(id -u)"
+	"${BRILLO_BIN}" -v 7 -s fake -S 41 2>&1 | grep -q "taking over slot 'backlight/fake'" || {
+		printf 'Stuck slot not taken over for test: shm stale\n'
+		ret=1
+	}
+	"${BRILLO_BIN}" -v 7 -s fake -S 40 2>&1 | grep -q "taking over" && {
+		printf 'Live slot taken over for test: shm stale\n'
+		ret=1
+	}
+}
+
+# the brightness was left at 40% just above
+"${BRILLO_BIN}" -v 5 -s fake -S 40 2>&1 | grep -q "already holds 400" || {
+	printf 'Unchanged value written for test: skip\n'
+	ret=1
+}
+
+# a minimum cap of 0 is stored where none was set before
+_fake class/leds/cap/max_brightness 3
+"${BRILLO_BIN}" -k -s cap -c -r -S 0
+test "$("${BRILLO_BIN}" -k -s cap -c -r -G 2>&1)" = 0 || {
+	printf 'Unexpected value for test: mincap\n'
+	ret=1
+}
+
+# a powered down panel is written at once, or once it is back with -w
+_fake class/backlight/fake/bl_power 4
+"${BRILLO_BIN}" -v 6 -s fake -u 1000000 -S 20 2>&1 | grep -q "writing at once" || {
+	printf 'Faded while powered down for test: bl_power\n'
+	ret=1
+}
+"${BRILLO_BIN}" -s fake -w -S 35 &
+defer=$!
+sleep 0.2
+_ckval "defer" class/backlight/fake/brightness 200
+_fake class/backlight/fake/bl_power 0
+wait "${defer}"
+_ckval "defer" class/backlight/fake/brightness 350
+
+# a burst of steps lands as their sum
+for step in 1 2 3 4 5 6 7 8 9 10; do
+	"${BRILLO_BIN}" -s fake -r -A 1 &
+done
+wait
+_ckval "steps" class/backlight/fake/brightness 360
+
+# a step left behind long ago by a killed process is dropped
+! command -v python3 >/dev/null || {
+	cache="${XDG_CACHE_HOME}/brillo"
+	test "$(id -u)" != 0 || cache=/var/cache/brillo
+	python3 -c 'import struct, sys
+open(sys.argv[1], "wb").write(struct.pack("8q", 0, 50, 0, 0, 1, 1, 0, 0))' \
+		"${cache}/backlight.fake.delta"
+	"${BRILLO_BIN}" -s fake -r -A 1
+	_ckval "steps stale" class/backlight/fake/brightness 361
+}
+
+# a hot thermal zone caps the brightness, uevents arrive on BRILLO_UEVENT
+! command -v python3 >/dev/null || {
+	mkdir "${sys}/run"
+	export BRILLO_RUN="${sys}/run"
+	_fake class/thermal/thermal_zone0/temp 50000
+	_fake class/thermal/thermal_zone0/trip_point_0_type passive
+	_fake class/thermal/thermal_zone0/trip_point_0_temp 80000
+	_fake class/thermal/thermal_zone0/trip_point_0_hyst 5000
+	_fake class/thermal/thermal_zone0/policy user_space
+
+	_uevent() {
+		_fake class/thermal/thermal_zone0/temp "$1"
+		python3 -c 'import socket, sys
+socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM).sendto(
+    b"change@/devices/virtual/thermal/thermal_zone0\0SUBSYSTEM=thermal\0", sys.argv[1])' \
+			"${sys}/uevent"
+		sleep 0.2
+	}
+
+	"${BRILLO_BIN}" -s fake -S 90
+	BRILLO_UEVENT="${sys}/uevent" "${BRILLO_BIN}" -s fake -u 1000 -Z &
+	thermal=$!
+	while test ! -S "${sys}/uevent"; do sleep 0.1; done
+
+	_uevent 85000
+	_ckval "opmode=thermal hot" class/backlight/fake/brightness 500
+	"${BRILLO_BIN}" -s fake -S 80
+	_ckval "opmode=thermal set" class/backlight/fake/brightness 500
+	_uevent 78000
+	_ckval "opmode=thermal hysteresis" class/backlight/fake/brightness 500
+	_uevent 70000
+	_ckval "opmode=thermal cool" class/backlight/fake/brightness 900
+
+	kill -INT "${thermal}"
+	wait "${thermal}"
+
+	# a cap that others could have written is ignored
+	_fake run/brillo/backlight.fake.maxcap 100
+	chmod 666 "${sys}/run/brillo/backlight.fake.maxcap"
+	"${BRILLO_BIN}" -s fake -S 95 2>/dev/null
+	_ckval "opmode=thermal foreign" class/backlight/fake/brightness 950
+	rm "${sys}/run/brillo/backlight.fake.maxcap"
+
+	# the cap bounds every color of a multicolor LED
+	_fake class/leds/rgb:hot/max_brightness 255
+	_fake class/leds/rgb:hot/multi_intensity "255 0 0"
+	_fake run/brillo/leds.rgb:hot.maxcap 100
+	"${BRILLO_BIN}" -k -s rgb:hot -i -S 0,50,100
+	_ckval "opmode=thermal multi" class/leds/rgb:hot/multi_intensity "0 100 100"
+	rm "${sys}/run/brillo/leds.rgb:hot.maxcap"
+}
+
+_fake class/leds/rgb:fake/max_brightness 255
+_fake class/leds/rgb:fake/multi_intensity "255 0 0"
+
+_ckvg "field=multi" -k -s rgb:fake -i -u 50000 -S 0,50,100
+_ckval "field=multi" class/leds/rgb:fake/multi_intensity "0 127 255"
+
+_fake class/leds/kbd/max_brightness 3
+_fake class/leds/kbd/brightness 0
+_fake class/leds/kbd/trigger "none [kbd-capslock] pattern"
+
+_ckvg "dither=pattern" -k -s kbd -D -S 50
+_ckval "dither=pattern" class/leds/kbd/pattern "1 8 1 0 2 8 2 0"
+
+_fake class/leds/pulse/max_brightness 3
+_fake class/leds/pulse/brightness 0
+_fake class/leds/pulse/trigger "none [kbd-capslock] pattern"
+printf '3 100 step\nstart 50\nrepeat 2\n' > "${sys}/keyframes"
+
+_ckvg "opmode=animate" -k -s pulse -r -F "${sys}/keyframes"
+_ckval "opmode=animate" class/leds/pulse/pattern "0 0 3 100 3 50"
+_ckval "opmode=animate" class/leds/pulse/repeat 2
+
+_panel() {
+	_fake "class/backlight/$1/max_brightness" "$2"
+	_fake "class/backlight/$1/brightness" 0
+	_fake "class/backlight/$1/type" "$3"
+	mkdir -p "${sys}/devices/$4"
+	ln -s "../../../devices/$4" "${sys}/class/backlight/$1/device"
+}
+
+# firmware and native interface to one panel, only the firmware one
+# is written; a firmware one above two panels cannot be told apart
+_panel acpi_video0 100 firmware pci0
+_panel intel_backlight 937 raw pci0/drm/card0-eDP-1
+_panel acpi_video1 100 firmware pci1
+_panel amdgpu_bl0 255 raw pci1/drm/card1-eDP-1
+_panel amdgpu_bl1 255 raw pci1/drm/card1-eDP-2
+
+_ckvg "ctrl=group" -e -S 50
+_ckval "ctrl=group" class/backlight/acpi_video0/brightness 50
+_ckval "ctrl=group" class/backlight/intel_backlight/brightness 0
+_ckval "ctrl=group" class/backlight/acpi_video1/brightness 50
+_ckval "ctrl=group" class/backlight/amdgpu_bl0/brightness 127
+_ckval "ctrl=group" class/backlight/amdgpu_bl1/brightness 127
+
+# a keyboard backlight following the panel from 20 to 80 percent
+_fake class/leds/follower/max_brightness 100
+_fake class/leds/follower/brightness 0
+printf 'follow.leds/follower backlight/fake 20 80\n' > "${sys}/follow.conf"
+
+BRILLO_CONF="${sys}/follow.conf" "${BRILLO_BIN}" -s fake -S 90
+_ckval "follow=high" class/backlight/fake/brightness 900
+_ckval "follow=high" class/leds/follower/brightness 100
+BRILLO_CONF="${sys}/follow.conf" "${BRILLO_BIN}" -s fake -u 100000 -S 50
+_ckval "follow=fade" class/backlight/fake/brightness 500
+_ckval "follow=fade" class/leds/follower/brightness 50
+BRILLO_CONF="${sys}/follow.conf" "${BRILLO_BIN}" -s fake -S 10
+_ckval "follow=low" class/leds/follower/brightness 0
+
+# keyframes played on a backlight in the foreground
+printf '600 100 linear\nstart 50 step\n250 100\n' > "${sys}/keyframes"
+_ckvg "opmode=animate backlight" -s fake -r -F "${sys}/keyframes"
+_ckval "opmode=animate backlight" class/backlight/fake/brightness 250
+
+# early boot variant, see the restore make target
+test ! -x "${BRILLO_BIN}-restore" || {
+	"${BRILLO_BIN}-restore" -s fake -S 42.5
+	_ckval "variant=restore" class/backlight/fake/brightness 425
+}
+
+# DDC/CI display stand-in on a unix socket, see BRILLO_DEV
+! command -v python3 >/dev/null || {
+	mkdir -p "${sys}/dev"
+	export BRILLO_DEV="${sys}/dev"
+
+	python3 - "${sys}/dev/i2c-0" "${sys}/ddc" <<'EOF' &
+import functools, operator, socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind(sys.argv[1])
+s.listen(1)
+cur = 40
+while True:
+    c = s.accept()[0]
+    while True:
+        h = c.recv(2, socket.MSG_WAITALL)
+        if len(h) < 2:
+            break
+        b = c.recv((h[1] & 0x7f) + 1, socket.MSG_WAITALL)
+        if b[0] == 0x01:
+            r = bytes([0x6e, 0x88, 0x02, 0, 0x10, 0, 0, 100, cur >> 8, cur & 0xff])
+            c.sendall(r + bytes([functools.reduce(operator.xor, r, 0x50)]))
+        elif b[0] == 0x03:
+            cur = b[2] << 8 | b[3]
+            open(sys.argv[2], 'w').write('%d\n' % cur)
+EOF
+	mocks="${mocks} $!"
+	while test ! -S "${sys}/dev/i2c-0"; do sleep 0.1; done
+
+	_ckvg "ctrl=ddc" -s ddc:i2c-0 -u 200000 -S 30
+	_ckval "ctrl=ddc" ddc 30
+	_ckvg "ctrl=ddc opmode=list" -L
+
+	# only the DDC bus of a display connector is probed, and never by -L
+	mkdir -p "${sys}/class/drm/card0-DP-1/i2c-0"
+	! "${BRILLO_BIN}" -L | grep -q "^ddc:i2c-0$" && "${BRILLO_BIN}" -e -G >/dev/null &&
+	"${BRILLO_BIN}" -L | grep -q "^ddc:i2c-0$" || {
+		printf 'Display not probed once for test: ctrl=ddc probe\n'
+		ret=1
+	}
+}
+
+# brightness keys from a FIFO standing in for an event device, see
+# BRILLO_DEV; a key pressed while dimmed lands on the restored value,
+# and the keyboard toggle outlives going idle in between
+! command -v python3 >/dev/null || {
+	mkdir -p "${sys}/dev/input"
+	mkfifo "${sys}/dev/input/event0"
+	printf 'idle.timeout 1\nidle.dim 10\nkeyboard.ctrl kbd_backlight\n' > "${sys}/input.conf"
+	_fake class/leds/kbd_backlight/max_brightness 3
+	_fake class/leds/kbd_backlight/brightness 2
+	"${BRILLO_BIN}" -k -s kbd_backlight -c -r -S 0
+
+	_key() {
+		python3 -c 'import struct, sys
+ev = lambda t, c, v: struct.pack("llHHi", 0, 0, t, c, v)
+c = int(sys.argv[2])
+open(sys.argv[1], "wb").write(ev(1, c, 1) + ev(0, 0, 0) + ev(1, c, 0) + ev(0, 0, 0))' \
+			"${sys}/dev/input/event0" "${1:-225}"
+		sleep 0.5
+	}
+
+	"${BRILLO_BIN}" -s fake -S 80
+	exec 7<>"${sys}/dev/input/event0"
+	BRILLO_DEV="${sys}/dev" BRILLO_CONF="${sys}/input.conf" "${BRILLO_BIN}" -s fake -K &
+	keys=$!
+	sleep 0.5
+
+	_key 228
+	_ckval "opmode=input toggle" class/leds/kbd_backlight/brightness 0
+	_key
+	_ckval "opmode=input key" class/backlight/fake/brightness 850
+	sleep 2
+	_ckval "opmode=input idle" class/backlight/fake/brightness 100
+	_key
+	_ckval "opmode=input wake" class/backlight/fake/brightness 900
+	_key 228
+	_ckval "opmode=input toggle back" class/leds/kbd_backlight/brightness 2
+
+	kill -INT "${keys}"
+	wait "${keys}"
+	exec 7>&-
+}
+
+# logind stand-in on a unix socket, for a caller that can't write sysfs
+! command -v python3 >/dev/null || ! command -v setpriv >/dev/null ||
+test "$(id -u)" != 0 || {
+	export DBUS_SYSTEM_BUS_ADDRESS="unix:path=${sys}/dbus"
+
+	python3 - "${sys}/dbus" "${sys}" <<'EOF' &
+import os, socket, struct, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind(sys.argv[1])
+os.chmod(sys.argv[1], 0o777)
+s.listen(1)
+def reply(serial, sig=b'', body=b''):
+    f = b'\x05\x01u\x00' + struct.pack('<I', serial)
+    if sig:
+        f += b'\x08\x01g\x00' + bytes([len(sig)]) + sig + b'\x00'
+    h = struct.pack('<4sIII', b'l\x02\x00\x01', len(body), serial, len(f)) + f
+    return h + b'\x00' * (-len(h) % 8) + body
+def string(b, o):
+    o = (o + 3) & ~3
+    n = struct.unpack_from('<I', b, o)[0]
+    return b[o + 4:o + 4 + n].decode(), o + 5 + n
+while True:
+    c = s.accept()[0].makefile('rwb', 0)
+    while c.readline() != b'BEGIN\r\n':
+        c.write(b'OK 0123456789abcdef0123456789abcdef\r\n')
+    while True:
+        h = c.read(16)
+        if len(h) < 16:
+            break
+        blen, serial, flen = struct.unpack_from('<III', h, 4)
+        f = c.read((flen + 7) & ~7)
+        b = c.read(blen)
+        if b'Hello' in f:
+            # a reply whose fields run past their end is ignored
+            c.write(struct.pack('<4sIII', b'l\x02\x00\x01', 0, 1, 12) +
+                    b'\x04\x01s\x00' + struct.pack('<I', 1 << 30) + b'\x05\x01u\x00' + b'\x00' * 4)
+            c.write(reply(serial, b's', struct.pack('<I', 4) + b':1.1\x00'))
+        elif b'Get' in f:
+            c.write(reply(serial, b'v', b'\x01b\x00\x00\x01\x00\x00\x00'))
+        else:
+            sub, o = string(b, 0)
+            name, o = string(b, o)
+            val = struct.unpack_from('<I', b, (o + 3) & ~3)[0]
+            open('%s/class/%s/%s/brightness' % (sys.argv[2], sub, name), 'w').write('%d\n' % val)
+            c.write(reply(serial))
+EOF
+	mocks="${mocks} $!"
+	while test ! -S "${sys}/dbus"; do sleep 0.1; done
+
+	chmod 755 "${sys}"
+	mkdir -m 777 "${sys}/nobody"
+	valgrind="${BRILLO_VALGRIND}"
+	BRILLO_VALGRIND="setpriv --reuid=65534 --regid=65534 --clear-groups"
+	BRILLO_VALGRIND="${BRILLO_VALGRIND} env XDG_CACHE_HOME=${sys}/nobody ${valgrind}"
+	_ckvg "backend=logind" -s fake -u 200000 -S 30
+	BRILLO_VALGRIND="${valgrind}"
+	_ckval "backend=logind" class/backlight/fake/brightness 300
+
+	# the latency of the bus is not that of the device
+	test ! -e "${sys}/nobody/brillo/backlight.fake.latency" || {
+		printf 'Latency cached through logind for test: backend=logind\n'
+		ret=1
+	}
+}
+
 exit "${ret}"